@@ -0,0 +1,72 @@
+/* Memory for messages decoded by the client. Everything decoded from one
+ * server message lives until the next one is decoded, so it is taken from
+ * an arena by moving a pointer and given back all at once. */
+
+#ifndef BOMBERMAN_ARENA_HPP
+#define BOMBERMAN_ARENA_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Initial size of the arena block, enough for turns of a typical game.
+static const size_t TURN_ARENA_SIZE = 1 << 16;
+
+// Monotonic memory resource reset once per message. Memory comes from one
+// block, and when a message needs more, the rest comes from overflow blocks.
+// On reset the block grows to fit everything the message used, so after
+// a few turns decoding does not touch the global heap at all.
+class TurnArena : public std::pmr::memory_resource {
+    std::unique_ptr<std::byte[]> block;
+    size_t capacity;
+    size_t used = 0;
+    std::vector<std::unique_ptr<std::byte[]>> overflow;
+    size_t overflow_bytes = 0;
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        void *memory = block.get() + used;
+        size_t space = capacity - used;
+        if (std::align(alignment, bytes, memory, space) != nullptr) {
+            used = capacity - space + bytes;
+            return memory;
+        }
+        space = bytes + alignment;
+        overflow.push_back(std::make_unique_for_overwrite<std::byte[]>(space));
+        overflow_bytes += space;
+        memory = overflow.back().get();
+        return std::align(alignment, bytes, memory, space);
+    }
+
+    // Memory is given back only on reset.
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource &that) const noexcept override {
+        return this == &that;
+    }
+
+   public:
+    explicit TurnArena(size_t initial_capacity = TURN_ARENA_SIZE)
+        : block(std::make_unique_for_overwrite<std::byte[]>(initial_capacity)),
+          capacity(initial_capacity) {}
+
+    TurnArena(const TurnArena &) = delete;
+    TurnArena &operator=(const TurnArena &) = delete;
+
+    // Gives back all memory. Nothing allocated from the arena may be used after it.
+    void reset() {
+        if (!overflow.empty()) {
+            size_t needed = used + overflow_bytes;
+            overflow.clear();
+            overflow_bytes = 0;
+            capacity = std::max(2 * capacity, needed);
+            block = std::make_unique_for_overwrite<std::byte[]>(capacity);
+        }
+        used = 0;
+    }
+
+    [[nodiscard]] size_t get_capacity() const { return capacity; }
+};
+
+#endif  // BOMBERMAN_ARENA_HPP
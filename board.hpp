@@ -0,0 +1,310 @@
+/* Positions on the board and set of board cells, used for blocks
+ * and explosions by both the client and the server game engine. */
+
+#ifndef BOMBERMAN_BOARD_HPP
+#define BOMBERMAN_BOARD_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+// Struct from task contents.
+struct Position {
+    uint16_t x{};
+    uint16_t y{};
+
+    Position(uint16_t cx, uint16_t cy) : x(cx), y(cy){};
+    Position() = default;
+    bool operator==(const Position &that) const { return x == that.x && y == that.y; };
+    bool operator<(const Position &that) const {
+        if (x < that.x)
+            return true;
+        else if (x == that.x)
+            return y < that.y;
+        else
+            return false;
+    };
+};
+
+// Boards with more cells than this keep cells in a hash set instead of a bitset.
+static const size_t DENSE_BOARD_MAX_CELLS = (size_t)1 << 26;
+
+static const size_t BOARD_WORD_BITS = 64;
+
+/* Word level operations on bitsets stored in vectors of 64 bit words. */
+
+// Returns index of the first set bit in [begin, end) or end if there is none.
+size_t find_first_set_bit(const std::vector<uint64_t> &bits, size_t begin, size_t end) {
+    if (begin >= end) return end;
+    size_t word = begin / BOARD_WORD_BITS;
+    size_t last_word = (end - 1) / BOARD_WORD_BITS;
+    uint64_t value = bits[word] & (~(uint64_t)0 << (begin % BOARD_WORD_BITS));
+    while (value == 0) {
+        if (word == last_word) return end;
+        value = bits[++word];
+    }
+    size_t found = word * BOARD_WORD_BITS + (size_t)std::countr_zero(value);
+    return found < end ? found : end;
+}
+
+// Returns index of the last set bit in [begin, end) or end if there is none.
+size_t find_last_set_bit(const std::vector<uint64_t> &bits, size_t begin, size_t end) {
+    if (begin >= end) return end;
+    size_t word = (end - 1) / BOARD_WORD_BITS;
+    size_t first_word = begin / BOARD_WORD_BITS;
+    uint64_t value =
+        bits[word] & (~(uint64_t)0 >> (BOARD_WORD_BITS - 1 - (end - 1) % BOARD_WORD_BITS));
+    while (value == 0) {
+        if (word == first_word) return end;
+        value = bits[--word];
+    }
+    size_t found = word * BOARD_WORD_BITS + BOARD_WORD_BITS - 1 - (size_t)std::countl_zero(value);
+    return found >= begin ? found : end;
+}
+
+// Sets bits in [begin, end) and returns how many of them were not set before.
+size_t set_bit_range(std::vector<uint64_t> &bits, size_t begin, size_t end) {
+    size_t added = 0;
+    while (begin < end) {
+        size_t word = begin / BOARD_WORD_BITS;
+        size_t offset = begin % BOARD_WORD_BITS;
+        size_t length = std::min(BOARD_WORD_BITS - offset, end - begin);
+        uint64_t mask = length == BOARD_WORD_BITS ? ~(uint64_t)0
+                                                  : (((uint64_t)1 << length) - 1) << offset;
+        added += (size_t)std::popcount(mask & ~bits[word]);
+        bits[word] |= mask;
+        begin += length;
+    }
+    return added;
+}
+
+// Cells are numbered column by column (cell = x * size_y + y), so iterating
+// over cells visits positions in the same order as std::set<Position>.
+// Small and medium boards are stored in a bitset with one bit per cell,
+// which gives constant time lookups and fast iteration over set cells.
+// Very large boards fall back to a hash set of cell numbers.
+// Board can also keep a row index, a second bitset numbered row by row,
+// so that rows can be scanned with word operations just like columns.
+class Board {
+    uint16_t size_x = 0;
+    uint16_t size_y = 0;
+    size_t count = 0;
+    bool dense = true;
+    bool row_index = false;
+
+    std::vector<uint64_t> bits;
+    // Cells numbered row by row (y * size_x + x), kept only with row index.
+    std::vector<uint64_t> row_bits;
+    // Words outside of [used_begin, used_end) are known to be zero,
+    // so clearing and iterating sparse boards stays cheap.
+    size_t used_begin = 0;
+    size_t used_end = 0;
+
+    std::unordered_set<uint32_t> sparse_cells;
+
+    [[nodiscard]] bool inside(Position p) const { return p.x < size_x && p.y < size_y; }
+
+    [[nodiscard]] size_t cell(Position p) const { return (size_t)p.x * size_y + p.y; }
+
+    [[nodiscard]] size_t row_cell(Position p) const { return (size_t)p.y * size_x + p.x; }
+
+    [[nodiscard]] bool has_row_bits() const { return dense && row_index; }
+
+    void mark_used(size_t first_word, size_t last_word) {
+        if (count == 0) {
+            used_begin = first_word;
+            used_end = last_word + 1;
+        } else {
+            used_begin = std::min(used_begin, first_word);
+            used_end = std::max(used_end, last_word + 1);
+        }
+    }
+
+    [[nodiscard]] Position position(size_t c) const {
+        return {(uint16_t)(c / size_y), (uint16_t)(c % size_y)};
+    }
+
+    void check_position(Position p) const {
+        if (!inside(p)) {
+            throw std::out_of_range("Position outside of the board");
+        }
+    }
+
+   public:
+    Board() = default;
+
+    Board(uint16_t sx, uint16_t sy, bool with_row_index = false) {
+        resize(sx, sy, with_row_index);
+    }
+
+    // Changes board dimensions and removes all cells.
+    void resize(uint16_t sx, uint16_t sy, bool with_row_index = false) {
+        size_x = sx;
+        size_y = sy;
+        row_index = with_row_index;
+        size_t cells = (size_t)size_x * size_y;
+        dense = cells <= DENSE_BOARD_MAX_CELLS;
+        size_t words = dense ? (cells + BOARD_WORD_BITS - 1) / BOARD_WORD_BITS : 0;
+        bits.assign(words, 0);
+        row_bits.assign(has_row_bits() ? words : 0, 0);
+        sparse_cells.clear();
+        used_begin = used_end = 0;
+        count = 0;
+    }
+
+    [[nodiscard]] uint16_t get_size_x() const { return size_x; }
+
+    [[nodiscard]] uint16_t get_size_y() const { return size_y; }
+
+    [[nodiscard]] size_t size() const { return count; }
+
+    [[nodiscard]] bool empty() const { return count == 0; }
+
+    [[nodiscard]] bool contains(Position p) const {
+        if (!inside(p)) return false;
+        size_t c = cell(p);
+        if (!dense) return sparse_cells.contains((uint32_t)c);
+        return (bits[c / BOARD_WORD_BITS] >> (c % BOARD_WORD_BITS)) & 1;
+    }
+
+    // Returns true if the cell was not set before.
+    bool insert(Position p) {
+        check_position(p);
+        size_t c = cell(p);
+        if (!dense) {
+            bool inserted = sparse_cells.insert((uint32_t)c).second;
+            count += inserted;
+            return inserted;
+        }
+        size_t word = c / BOARD_WORD_BITS;
+        uint64_t mask = (uint64_t)1 << (c % BOARD_WORD_BITS);
+        if (bits[word] & mask) return false;
+        bits[word] |= mask;
+        if (row_index) {
+            size_t r = row_cell(p);
+            row_bits[r / BOARD_WORD_BITS] |= (uint64_t)1 << (r % BOARD_WORD_BITS);
+        }
+        mark_used(word, word);
+        count++;
+        return true;
+    }
+
+    // Sets cells (x, y) for y in [y_begin, y_end) with word operations.
+    void insert_column(uint16_t x, uint16_t y_begin, uint16_t y_end) {
+        if (y_begin >= y_end) return;
+        check_position({x, (uint16_t)(y_end - 1)});
+        if (!dense || row_index) {
+            for (uint16_t y = y_begin; y < y_end; y++) {
+                insert({x, y});
+            }
+            return;
+        }
+        size_t begin = cell({x, y_begin});
+        size_t end = begin + (y_end - y_begin);
+        mark_used(begin / BOARD_WORD_BITS, (end - 1) / BOARD_WORD_BITS);
+        count += set_bit_range(bits, begin, end);
+    }
+
+    // Returns true if the cell was set before.
+    bool erase(Position p) {
+        if (!inside(p)) return false;
+        size_t c = cell(p);
+        if (!dense) {
+            bool erased = sparse_cells.erase((uint32_t)c) > 0;
+            count -= erased;
+            return erased;
+        }
+        size_t word = c / BOARD_WORD_BITS;
+        uint64_t mask = (uint64_t)1 << (c % BOARD_WORD_BITS);
+        if (!(bits[word] & mask)) return false;
+        bits[word] &= ~mask;
+        if (row_index) {
+            size_t r = row_cell(p);
+            row_bits[r / BOARD_WORD_BITS] &= ~((uint64_t)1 << (r % BOARD_WORD_BITS));
+        }
+        count--;
+        return true;
+    }
+
+    void clear() {
+        if (!dense) {
+            sparse_cells.clear();
+        } else if (count > 0) {
+            std::fill(bits.begin() + (ptrdiff_t)used_begin, bits.begin() + (ptrdiff_t)used_end,
+                      0);
+            std::fill(row_bits.begin(), row_bits.end(), 0);
+        }
+        used_begin = used_end = 0;
+        count = 0;
+    }
+
+    // Returns distance from the cell to the nearest set cell in the same
+    // column (up means increasing y), looking at most limit cells away.
+    // Returns 0 if there is no such cell. Cells past the edge are not checked.
+    [[nodiscard]] uint16_t column_distance(Position from, uint16_t limit, bool up) const {
+        limit = up ? std::min<uint16_t>(limit, (uint16_t)(size_y - 1 - from.y))
+                   : std::min(limit, from.y);
+        if (!dense) {
+            for (uint16_t d = 1; d <= limit; d++) {
+                if (contains({from.x, (uint16_t)(up ? from.y + d : from.y - d)})) return d;
+            }
+            return 0;
+        }
+        size_t c = cell(from);
+        if (up) {
+            size_t found = find_first_set_bit(bits, c + 1, c + 1 + limit);
+            return found == c + 1 + limit ? 0 : (uint16_t)(found - c);
+        }
+        size_t found = find_last_set_bit(bits, c - limit, c);
+        return found == c ? 0 : (uint16_t)(c - found);
+    }
+
+    // Same as column_distance, but in the row (right means increasing x).
+    // Uses word operations only if the board keeps row index.
+    [[nodiscard]] uint16_t row_distance(Position from, uint16_t limit, bool right) const {
+        limit = right ? std::min<uint16_t>(limit, (uint16_t)(size_x - 1 - from.x))
+                      : std::min(limit, from.x);
+        if (!has_row_bits()) {
+            for (uint16_t d = 1; d <= limit; d++) {
+                if (contains({(uint16_t)(right ? from.x + d : from.x - d), from.y})) return d;
+            }
+            return 0;
+        }
+        size_t r = row_cell(from);
+        if (right) {
+            size_t found = find_first_set_bit(row_bits, r + 1, r + 1 + limit);
+            return found == r + 1 + limit ? 0 : (uint16_t)(found - r);
+        }
+        size_t found = find_last_set_bit(row_bits, r - limit, r);
+        return found == r ? 0 : (uint16_t)(r - found);
+    }
+
+    // Calls function for every set cell in order of Position::operator<.
+    template <typename Function>
+    void for_each(Function function) const {
+        if (count == 0) return;
+        if (!dense) {
+            std::vector<uint32_t> cells(sparse_cells.begin(), sparse_cells.end());
+            std::sort(cells.begin(), cells.end());
+            for (auto c : cells) {
+                function(position(c));
+            }
+            return;
+        }
+        size_t visited = 0;
+        for (size_t word = used_begin; word < used_end && visited < count; word++) {
+            uint64_t value = bits[word];
+            while (value != 0) {
+                size_t c = word * BOARD_WORD_BITS + (size_t)std::countr_zero(value);
+                function(position(c));
+                value &= value - 1;
+                visited++;
+            }
+        }
+    }
+};
+
+#endif  // BOMBERMAN_BOARD_HPP
@@ -1,95 +1,221 @@
 #ifndef BOMBERMAN_BUFFER_HPP
 #define BOMBERMAN_BUFFER_HPP
 
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <algorithm>
 #include <boost/asio.hpp>
+#include <cassert>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
 #include <utility>
+#include <vector>
+
+#include "byteswap.hpp"
 
 // Constants for buffer sizes.
 static const size_t UDP_BUFF_SIZE = 65507;
 static const size_t TCP_BUFF_SIZE = 1024;
+// TCP stream buffer reads ahead, so it holds many messages at once.
+static const size_t TCP_STREAM_BUFF_SIZE = 65536;
+// Longest length prefixed message accepted from the server.
+static const size_t MAX_FRAME_SIZE = 1 << 26;
+// Longest length prefixed message accepted from a client. The longest one
+// it can send, Join with a name of 255 bytes, takes 257 bytes, the rest
+// is left for new message types.
+static const size_t MAX_CLIENT_FRAME_SIZE = 512;
 
 // Class buffer for reading and writing network messages.
+// Transport is the class deriving from the buffer, it decides what happens
+// when there is not enough space to write or not enough bytes to read.
+// It is known at compile time, so there are no virtual calls and checks
+// inline into the serialization code. Functions starting with put and get
+// do not check anything, so space has to be ensured before calling them.
+template <typename Transport>
 class Buffer {
    protected:
     char *buff;
     size_t size;
     size_t read_cursor = 0, write_cursor = 0;
+    // Whether buff was allocated by the buffer, or belongs to someone else.
+    bool owns_memory = true;
 
     explicit Buffer(size_t s) : size(s) { buff = new char[s]; }
 
+    Buffer(char *memory, size_t s) : buff(memory), size(s), owns_memory(false) {}
+
+    ~Buffer() {
+        if (owns_memory) delete[] buff;
+    }
+
+   public:
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
     // Function make sure that there is enough space in the buffer to write n
     // bytes.
-    virtual void ensureThatWriteIsPossible([[maybe_unused]] size_t to_write){};
+    void ensureWrite(size_t n) { static_cast<Transport *>(this)->ensureThatWriteIsPossible(n); }
+
     // Function make sure that there will be enough bytes to read.
-    virtual void ensureThatReadIsPossible([[maybe_unused]] size_t to_read){};
+    void ensureRead(size_t n) { static_cast<Transport *>(this)->ensureThatReadIsPossible(n); }
 
-   public:
-    virtual void receiveMsg([[maybe_unused]] size_t to_receive){};
-    virtual void sendMsg(){};
+    // Function makes space for writing elements of element_size bytes with
+    // one check. Returns how many of count elements can be written now,
+    // it is less than count when they do not fit into the buffer at once.
+    size_t ensureWriteElements(size_t count, size_t element_size) {
+        size_t batch = std::min(count, Transport::max_batch_size / element_size);
+        ensureWrite(batch * element_size);
+        return batch;
+    }
+
+    // Function makes sure that elements of element_size bytes can be read.
+    // Returns how many of count elements can be read now.
+    size_t ensureReadElements(size_t count, size_t element_size) {
+        size_t batch = std::min(count, Transport::max_batch_size / element_size);
+        ensureRead(batch * element_size);
+        return batch;
+    }
 
     // Functions for writing and reading standard data types into the buffer.
     // Each time we write we add sizeof(read variable) to write cursor.
     // Each time we read we add sizeof(read variable) to read cursor.
 
-    void writeUint8(const uint8_t &value) {
-        ensureThatWriteIsPossible(sizeof(uint8_t));
-        uint8_t value_to_send = value;
-        memcpy(buff + write_cursor, &value_to_send, sizeof(uint8_t));
+    void putUint8(uint8_t value) {
+        memcpy(buff + write_cursor, &value, sizeof(uint8_t));
         write_cursor += sizeof(uint8_t);
     }
 
-    void writeUint16(const uint16_t &value) {
-        ensureThatWriteIsPossible(sizeof(uint16_t));
+    void putUint16(uint16_t value) {
         uint16_t value_to_send = htons(value);
         memcpy(buff + write_cursor, &value_to_send, sizeof(uint16_t));
         write_cursor += sizeof(uint16_t);
     }
 
-    void writeUint32(const uint32_t &value) {
-        ensureThatWriteIsPossible(sizeof(uint32_t));
+    void putUint32(uint32_t value) {
         uint32_t value_to_send = htonl(value);
         memcpy(buff + write_cursor, &value_to_send, sizeof(uint32_t));
         write_cursor += sizeof(uint32_t);
     }
 
-    void writeString(const std::string &value) {
-        size_t length = value.length();
-        ensureThatWriteIsPossible(length * sizeof(char));
-        memcpy(buff + write_cursor, value.c_str(), length);
+    void putBytes(const char *bytes, size_t length) {
+        memcpy(buff + write_cursor, bytes, length);
         write_cursor += length;
     }
 
-    uint8_t readUint8() {
-        ensureThatReadIsPossible(sizeof(uint8_t));
-        auto retval = *((uint8_t *)(buff + read_cursor));
+    void putString(const std::string &value) { putBytes(value.data(), value.length()); }
+
+    // Puts count uint16 values from host memory, which does not have to be aligned.
+    void putUint16s(const void *values, size_t count) {
+        copy_network_uint16(buff + write_cursor, static_cast<const char *>(values), count);
+        write_cursor += count * sizeof(uint16_t);
+    }
+
+    uint8_t getUint8() {
+        uint8_t retval;
+        memcpy(&retval, buff + read_cursor, sizeof(uint8_t));
         read_cursor += sizeof(uint8_t);
         return retval;
     }
 
-    uint16_t readUint16() {
-        ensureThatReadIsPossible(sizeof(uint16_t));
-        auto retval = ntohs(*((uint16_t *)(buff + read_cursor)));
+    uint16_t getUint16() {
+        uint16_t retval;
+        memcpy(&retval, buff + read_cursor, sizeof(uint16_t));
         read_cursor += sizeof(uint16_t);
-        return retval;
+        return ntohs(retval);
     }
 
-    uint32_t readUint32() {
-        ensureThatReadIsPossible(sizeof(uint32_t));
-        auto retval = ntohl(*((uint32_t *)(buff + read_cursor)));
+    uint32_t getUint32() {
+        uint32_t retval;
+        memcpy(&retval, buff + read_cursor, sizeof(uint32_t));
         read_cursor += sizeof(uint32_t);
-        return retval;
+        return ntohl(retval);
     }
 
-    std::string readString(const size_t &length) {
-        ensureThatReadIsPossible(length * sizeof(char));
-        std::string retval;
-        retval.append(buff + read_cursor, length);
+    // Gets count uint16 values into host memory, which does not have to be aligned.
+    void getUint16s(void *values, size_t count) {
+        copy_network_uint16(static_cast<char *>(values), buff + read_cursor, count);
+        read_cursor += count * sizeof(uint16_t);
+    }
+
+    void getBytes(char *bytes, size_t length) {
+        memcpy(bytes, buff + read_cursor, length);
+        read_cursor += length;
+    }
+
+    std::string getString(size_t length) {
+        std::string retval(buff + read_cursor, length);
         read_cursor += length;
         return retval;
     }
 
-    virtual ~Buffer() { delete[] buff; }
+    void writeUint8(const uint8_t &value) {
+        ensureWrite(sizeof(uint8_t));
+        putUint8(value);
+    }
+
+    void writeUint16(const uint16_t &value) {
+        ensureWrite(sizeof(uint16_t));
+        putUint16(value);
+    }
+
+    void writeUint32(const uint32_t &value) {
+        ensureWrite(sizeof(uint32_t));
+        putUint32(value);
+    }
+
+    void writeString(const std::string &value) {
+        ensureWrite(value.length() * sizeof(char));
+        putString(value);
+    }
+
+    // Writes bytes in chunks that fit into the buffer.
+    void writeBytes(const char *bytes, size_t length) {
+        while (length > 0) {
+            size_t chunk = std::min(length, Transport::max_batch_size);
+            ensureWrite(chunk);
+            putBytes(bytes, chunk);
+            bytes += chunk;
+            length -= chunk;
+        }
+    }
+
+    uint8_t readUint8() {
+        ensureRead(sizeof(uint8_t));
+        return getUint8();
+    }
+
+    uint16_t readUint16() {
+        ensureRead(sizeof(uint16_t));
+        return getUint16();
+    }
+
+    uint32_t readUint32() {
+        ensureRead(sizeof(uint32_t));
+        return getUint32();
+    }
+
+    std::string readString(const size_t &length) {
+        ensureRead(length * sizeof(char));
+        return getString(length);
+    }
+
+    // Moves next length bytes to other buffer, in chunks that fit into this one.
+    template <typename Other>
+    void readBytes(Buffer<Other> &other, size_t length) {
+        while (length > 0) {
+            size_t chunk = std::min(length, Transport::max_batch_size);
+            ensureRead(chunk);
+            other.writeBytes(buff + read_cursor, chunk);
+            read_cursor += chunk;
+            length -= chunk;
+        }
+    }
 
     // Function checks if there is something left in the buffer.
     // Used when we want to make sure that nothing is in the buffer.
@@ -101,21 +227,52 @@ class Buffer {
 };
 
 // Buffer for sending and reading UDP messages.
-class UDPBuffer : public Buffer {
+class UDPBuffer : public Buffer<UDPBuffer> {
+    friend class Buffer<UDPBuffer>;
+
     boost::asio::ip::udp::socket &udp_socket;
     boost::asio::ip::udp::endpoint udp_endpoint;
 
+    static constexpr size_t max_batch_size = UDP_BUFF_SIZE;
+
+    // Message has to fit in one datagram.
+    void ensureThatWriteIsPossible(const size_t to_write) {
+        if (write_cursor + to_write > size) {
+            throw std::length_error("Message does not fit in UDP datagram");
+        }
+    }
+
+    // Reading past the received datagram means that it is too short.
+    void ensureThatReadIsPossible(const size_t to_read) {
+        if (write_cursor - read_cursor < to_read) {
+            throw std::length_error("UDP message is too short");
+        }
+    }
+
    public:
     UDPBuffer(boost::asio::ip::udp::socket &socket, boost::asio::ip::udp::endpoint endpoint)
         : Buffer(UDP_BUFF_SIZE), udp_socket(socket), udp_endpoint(std::move(endpoint)) {}
 
     // If we receive message we treat write cursor as message size.
-    void receiveMsg([[maybe_unused]] size_t to_receive) override {
+    void receiveMsg() {
         read_cursor = 0;
         write_cursor = udp_socket.receive(boost::asio::buffer(buff, size));
     }
 
-    void sendMsg() override {
+    // Receives message without blocking, handler gets the error code.
+    template <typename Handler>
+    void asyncReceiveMsg(Handler handler) {
+        udp_socket.async_receive(
+            boost::asio::buffer(buff, size),
+            [this, handler = std::move(handler)](const boost::system::error_code &error,
+                                                 size_t received) mutable {
+                read_cursor = 0;
+                write_cursor = error ? 0 : received;
+                handler(error);
+            });
+    }
+
+    void sendMsg() {
         udp_socket.send_to(boost::asio::buffer(buff, write_cursor), udp_endpoint);
         read_cursor = 0;
         write_cursor = 0;
@@ -123,28 +280,27 @@ class UDPBuffer : public Buffer {
 };
 
 // Buffer for sending and reading TCP messages.
-class TCPBuffer : public Buffer {
+class TCPBuffer : public Buffer<TCPBuffer> {
+    friend class Buffer<TCPBuffer>;
+
     boost::asio::ip::tcp::socket &tcp_socket;
 
+    static constexpr size_t max_batch_size = TCP_STREAM_BUFF_SIZE;
+
     // Function checks if it is possible to read to_read bytes from buffer.
-    // If it exceeded buff size we move buffer contents to the left.
-    void ensureThatReadIsPossible(const size_t to_read) override {
-        if (read_cursor + to_read > size) {
-            for (size_t i = 0; i < write_cursor - read_cursor; i++) {
-                buff[i] = buff[read_cursor + i];
-            }
-            write_cursor -= read_cursor;
-            read_cursor = 0;
-        }
-        // If buffer content size is smaller than to_read we need another
-        // message.
-        if (write_cursor - read_cursor < to_read) {
-            receiveMsg(to_read - (write_cursor - read_cursor));
-        }
+    // Received data is read from memory until the buffer runs dry. Then the
+    // few bytes left are moved to the beginning and the buffer is refilled.
+    void ensureThatReadIsPossible(const size_t to_read) {
+        size_t available = write_cursor - read_cursor;
+        if (available >= to_read) return;
+        memmove(buff, buff + read_cursor, available);
+        write_cursor = available;
+        read_cursor = 0;
+        receiveMsg(to_read - available);
     }
 
     // If we exceeded buffer size we just send the message.
-    void ensureThatWriteIsPossible(const size_t to_write) override {
+    void ensureThatWriteIsPossible(const size_t to_write) {
         if (write_cursor + to_write > size) {
             sendMsg();
         }
@@ -152,22 +308,62 @@ class TCPBuffer : public Buffer {
 
    public:
     explicit TCPBuffer(boost::asio::ip::tcp::socket &socket)
-        : Buffer(TCP_BUFF_SIZE), tcp_socket(socket) {}
-
-    // Receive exactly to_receive bytes.
-    void receiveMsg(size_t to_receive) override {
-        boost::system::error_code error;
-        boost::asio::read(tcp_socket, boost::asio::buffer(buff + write_cursor, to_receive), error);
-        if (error == boost::asio::error::eof) {
-            throw std::invalid_argument("Connection closed by peer");
-        } else if (error) {
-            throw boost::system::system_error(error);
+        : Buffer(TCP_STREAM_BUFF_SIZE), tcp_socket(socket) {}
+
+    // Receive at least to_receive bytes. Every read takes everything the
+    // socket has already received, as much as fits into the buffer.
+    void receiveMsg(size_t to_receive) {
+        size_t received = 0;
+        while (received < to_receive) {
+            boost::system::error_code error;
+            size_t n = tcp_socket.read_some(
+                boost::asio::buffer(buff + write_cursor, size - write_cursor), error);
+            if (error == boost::asio::error::eof) {
+                throw std::invalid_argument("Connection closed by peer");
+            } else if (error) {
+                throw boost::system::system_error(error);
+            }
+            write_cursor += n;
+            received += n;
         }
-        write_cursor += to_receive;
+    }
+
+    // Moves bytes already received by the socket into the free end of the
+    // buffer with a single non-blocking read, compacting the buffer first when
+    // its end is full. Returns whether any bytes were moved; false while the
+    // socket is readable means it was closed or the buffer is full. Errors are
+    // left for the next read to report.
+    bool receiveAvailable() {
+        if (write_cursor == size && read_cursor > 0) {
+            size_t available = write_cursor - read_cursor;
+            memmove(buff, buff + read_cursor, available);
+            write_cursor = available;
+            read_cursor = 0;
+        }
+        if (write_cursor == size) return false;
+        ssize_t n = recv(tcp_socket.native_handle(), buff + write_cursor, size - write_cursor,
+                         MSG_DONTWAIT);
+        if (n <= 0) return false;
+        write_cursor += (size_t)n;
+        return true;
+    }
+
+    // Returns all received bytes that were not read yet.
+    [[nodiscard]] std::span<const char> unreadBytes() const {
+        return {buff + read_cursor, write_cursor - read_cursor};
+    }
+
+    // Waits until the socket receives bytes or the deadline passes.
+    // Returns whether there are bytes to read.
+    bool waitForInput(std::chrono::steady_clock::time_point deadline) {
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        pollfd socket_fd{tcp_socket.native_handle(), POLLIN, 0};
+        return poll(&socket_fd, 1, (int)std::max<int64_t>(timeout.count(), 0)) > 0;
     }
 
     // Send message with all buffer contents.
-    void sendMsg() override {
+    void sendMsg() {
         if (write_cursor - read_cursor > 0) {
             boost::asio::write(tcp_socket,
                                boost::asio::buffer(buff + read_cursor, write_cursor - read_cursor));
@@ -177,4 +373,119 @@ class TCPBuffer : public Buffer {
     }
 };
 
+// Immutable encoded message. It is shared by all sessions it is sent to,
+// so broadcasting a message does not copy or encode it again.
+using SharedBytes = std::shared_ptr<const std::vector<char>>;
+
+// Exception thrown when there is not enough received data to decode a message.
+class incomplete_message : public std::runtime_error {
+   public:
+    incomplete_message() : std::runtime_error("Message is not complete") {}
+};
+
+// Buffer keeping all data in memory, used by asynchronous sessions.
+// Writing always succeeds, because the buffer grows when needed.
+// Reading past received data throws incomplete_message, so the caller
+// can rewind, wait for more bytes and try to decode the message again.
+class MemoryBuffer : public Buffer<MemoryBuffer> {
+    friend class Buffer<MemoryBuffer>;
+
+    // Buffer grows, so all elements of a container are checked at once.
+    static constexpr size_t max_batch_size = std::numeric_limits<size_t>::max();
+
+    void reserve(size_t needed) {
+        if (needed <= size) return;
+        size_t new_size = std::max(needed, 2 * size);
+        char *new_buff = new char[new_size];
+        memcpy(new_buff, buff, write_cursor);
+        delete[] buff;
+        buff = new_buff;
+        size = new_size;
+    }
+
+    void ensureThatWriteIsPossible(const size_t to_write) {
+        reserve(write_cursor + to_write);
+    }
+
+    void ensureThatReadIsPossible(const size_t to_read) {
+        if (write_cursor - read_cursor < to_read) {
+            throw incomplete_message();
+        }
+    }
+
+   public:
+    explicit MemoryBuffer(size_t s = TCP_BUFF_SIZE) : Buffer(s) {}
+
+    // Returns space for at least n bytes after stored data.
+    // Bytes written there become readable after commit(n).
+    char *prepare(size_t n) {
+        reserve(write_cursor + n);
+        return buff + write_cursor;
+    }
+
+    void commit(size_t n) { write_cursor += n; }
+
+    [[nodiscard]] size_t readPosition() const { return read_cursor; }
+
+    void rewind(size_t position) { read_cursor = position; }
+
+    // Removes already read bytes from the beginning of the buffer.
+    void discardRead() {
+        memmove(buff, buff + read_cursor, write_cursor - read_cursor);
+        write_cursor -= read_cursor;
+        read_cursor = 0;
+    }
+
+    [[nodiscard]] const char *data() const { return buff + read_cursor; }
+
+    [[nodiscard]] size_t length() const { return write_cursor - read_cursor; }
+
+    void clear() {
+        read_cursor = 0;
+        write_cursor = 0;
+    }
+
+    // Returns copy of stored data that can be shared between sessions.
+    [[nodiscard]] SharedBytes share() const {
+        return std::make_shared<const std::vector<char>>(data(), data() + length());
+    }
+
+    void swap(MemoryBuffer &other) noexcept {
+        std::swap(buff, other.buff);
+        std::swap(size, other.size);
+        std::swap(read_cursor, other.read_cursor);
+        std::swap(write_cursor, other.write_cursor);
+    }
+};
+
+// Buffer over memory of known size, like a message of known length. When
+// writing, space for everything has been reserved by the caller, so there
+// are no capacity checks at all. Reading past the end is an error.
+class SpanBuffer : public Buffer<SpanBuffer> {
+    friend class Buffer<SpanBuffer>;
+
+    static constexpr size_t max_batch_size = std::numeric_limits<size_t>::max();
+
+    void ensureThatWriteIsPossible([[maybe_unused]] const size_t to_write) {
+        assert(write_cursor + to_write <= size);
+    }
+
+    void ensureThatReadIsPossible(const size_t to_read) {
+        if (write_cursor - read_cursor < to_read) {
+            throw std::length_error("Message is too short");
+        }
+    }
+
+   public:
+    // Buffer for writing into memory of given size.
+    SpanBuffer(char *memory, size_t s) : Buffer(memory, s) {}
+
+    // Buffer for reading all given bytes.
+    SpanBuffer(const char *memory, size_t s) : Buffer(const_cast<char *>(memory), s) {
+        write_cursor = s;
+    }
+
+    [[nodiscard]] size_t length() const { return write_cursor - read_cursor; }
+};
+
 #endif  // BOMBERMAN_BUFFER_HPP
@@ -0,0 +1,91 @@
+/* Bulk conversion of uint16 arrays between host and network byte order.
+ * Positions are written as such arrays and take most bytes of game messages
+ * on large boards, so they are converted with vector shuffles when the CPU
+ * supports them. Implementation is chosen once, at program start. */
+
+#ifndef BOMBERMAN_BYTESWAP_HPP
+#define BOMBERMAN_BYTESWAP_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BOMBERMAN_HAS_X86_SIMD 1
+#endif
+
+using CopySwappedFunction = void (*)(char *, const char *, size_t);
+
+// Copies count uint16 values from source to destination swapping their bytes,
+// one value at a time. Neither of pointers has to be aligned.
+void copy_swapped_uint16_scalar(char *destination, const char *source, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint16_t value;
+        memcpy(&value, source + i * sizeof(uint16_t), sizeof(uint16_t));
+        value = (uint16_t)(value << 8 | value >> 8);
+        memcpy(destination + i * sizeof(uint16_t), &value, sizeof(uint16_t));
+    }
+}
+
+#ifdef BOMBERMAN_HAS_X86_SIMD
+
+// Same as copy_swapped_uint16_scalar, eight values per shuffle.
+__attribute__((target("ssse3"))) void copy_swapped_uint16_ssse3(char *destination,
+                                                                const char *source,
+                                                                size_t count) {
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i values = _mm_loadu_si128((const __m128i *)(source + i * sizeof(uint16_t)));
+        _mm_storeu_si128((__m128i *)(destination + i * sizeof(uint16_t)),
+                         _mm_shuffle_epi8(values, swap));
+    }
+    copy_swapped_uint16_scalar(destination + i * sizeof(uint16_t),
+                               source + i * sizeof(uint16_t), count - i);
+}
+
+// Same as copy_swapped_uint16_scalar, sixteen values per shuffle.
+__attribute__((target("avx2"))) void copy_swapped_uint16_avx2(char *destination,
+                                                              const char *source,
+                                                              size_t count) {
+    const __m256i swap =
+        _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                         1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i values = _mm256_loadu_si256((const __m256i *)(source + i * sizeof(uint16_t)));
+        _mm256_storeu_si256((__m256i *)(destination + i * sizeof(uint16_t)),
+                            _mm256_shuffle_epi8(values, swap));
+    }
+    copy_swapped_uint16_ssse3(destination + i * sizeof(uint16_t),
+                              source + i * sizeof(uint16_t), count - i);
+}
+
+#endif  // BOMBERMAN_HAS_X86_SIMD
+
+// Function returns the fastest implementation supported by the CPU.
+CopySwappedFunction select_copy_swapped_uint16() {
+#ifdef BOMBERMAN_HAS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return copy_swapped_uint16_avx2;
+    if (__builtin_cpu_supports("ssse3")) return copy_swapped_uint16_ssse3;
+#endif
+    return copy_swapped_uint16_scalar;
+}
+
+static const CopySwappedFunction copy_swapped_uint16_implementation =
+    select_copy_swapped_uint16();
+
+// Copies count uint16 values converting them from host to network byte order,
+// or back, as both conversions are the same.
+void copy_network_uint16(char *destination, const char *source, size_t count) {
+    if constexpr (std::endian::native == std::endian::big) {
+        memcpy(destination, source, count * sizeof(uint16_t));
+    } else {
+        copy_swapped_uint16_implementation(destination, source, count);
+    }
+}
+
+#endif  // BOMBERMAN_BYTESWAP_HPP
@@ -8,15 +8,26 @@
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <memory_resource>
+#include <optional>
 #include <set>
 #include <vector>
 
+#include "board.hpp"
+#include "tables.hpp"
+
 #define DECIMAL_BASE 10
 
 using player_id_t = uint8_t;
 using bomb_id_t = uint32_t;
 using score_t = uint32_t;
 
+// Implementation of sockets used by the server.
+enum IoBackend : uint8_t {
+    AsioBackend = 0,
+    UringBackend = 1
+};
+
 // Struct for storing data from the server command line.
 struct server_parameters {
     uint16_t bomb_timer{};
@@ -30,6 +41,10 @@ struct server_parameters {
     uint16_t size_y{};
     uint32_t seed{};
     uint16_t port{};
+    uint16_t threads{};
+    uint16_t spectator_port{};
+    IoBackend backend = AsioBackend;
+    uint32_t output_limit{};
 
     server_parameters() = default;
 };
@@ -38,13 +53,18 @@ struct server_parameters {
 
 enum MessageToGuiEnum : uint8_t {
     Lobby = 0,
-    Game = 1
+    Game = 1,
+    // Changes since the previous Game or GameDelta message, sent instead
+    // of Game messages when the client runs in delta mode.
+    GameDelta = 2
 };
 
 enum GuiInputEnum : uint8_t {
     PlaceBombGui = 0,
     PlaceBlockGui = 1,
-    MoveGui = 2
+    MoveGui = 2,
+    // Asks the client in delta mode to send the next turn as full Game message.
+    RequestKeyframeGui = 3
 };
 
 enum Direction : uint8_t {
@@ -58,7 +78,9 @@ enum ClientMessageEnum : uint8_t {
     Join = 0,
     PlaceBomb = 1,
     PlaceBlock = 2,
-    Move = 3
+    Move = 3,
+    // Asks server to prefix all following messages with their length.
+    EnableFraming = 4
 };
 
 enum ServerMessageEnum : uint8_t {
@@ -66,7 +88,17 @@ enum ServerMessageEnum : uint8_t {
     AcceptedPlayer = 1,
     GameStarted = 2,
     Turn = 3,
-    GameEnded = 4
+    GameEnded = 4,
+    // Last message not prefixed with its length.
+    FramingEnabled = 5
+};
+
+// Messages sent only to spectators, numbered after messages of the server.
+enum SpectatorMessageEnum : uint8_t {
+    // Whole state of a game, for spectators that start watching it late.
+    Snapshot = 6,
+    // Message of a game that does not fit in a datagram, followed by its type.
+    MessageDropped = 7
 };
 
 enum EventType : uint8_t {
@@ -96,22 +128,6 @@ struct Player {
     Player() = default;
 };
 
-struct Position {
-    uint16_t x{};
-    uint16_t y{};
-
-    Position(uint16_t cx, uint16_t cy) : x(cx), y(cy){};
-    Position() = default;
-    bool operator<(const Position &that) const {
-        if (x < that.x)
-            return true;
-        else if (x == that.x)
-            return y < that.y;
-        else
-            return false;
-    };
-};
-
 struct Bomb {
     Position position;
     uint16_t timer{};
@@ -120,6 +136,38 @@ struct Bomb {
     Bomb() = default;
 };
 
+// Changes of game state made by one turn. Gui applies them to the state
+// of turn base_turn in order: blocks placed, blocks destroyed, robots moved,
+// timers of all bombs decreased by one, bombs placed, bombs exploded, scores.
+// Like in Game messages bombs have no id's, exploded bomb is the one with
+// the same position and timer. Explosions of the turn are sent whole.
+//
+// GameDelta message is encoded in this order, lists and maps like in Game
+// messages: type (uint8), turn (uint16), base_turn (uint16), blocks_placed
+// (list of positions), blocks_destroyed (list of positions), player_positions
+// (map of player id to position), bombs_placed (list of bombs), bombs_exploded
+// (list of bombs), scores (map of player id to score), explosions of the turn
+// (list of positions). Scores come before explosions.
+class GuiDelta {
+   public:
+    uint16_t base_turn{};
+    std::vector<Position> blocks_placed;
+    std::vector<Position> blocks_destroyed;
+    PlayerTable<Position> player_positions;
+    std::vector<Bomb> bombs_placed;
+    std::vector<Bomb> bombs_exploded;
+    PlayerTable<score_t> scores;
+
+    void clear() {
+        blocks_placed.clear();
+        blocks_destroyed.clear();
+        player_positions.clear();
+        bombs_placed.clear();
+        bombs_exploded.clear();
+        scores.clear();
+    }
+};
+
 class MessageToGui {
    public:
     MessageToGui() = default;
@@ -133,22 +181,50 @@ class MessageToGui {
     uint16_t explosion_radius{};
     uint16_t bomb_timer{};
     uint16_t turn{};
-    std::map<player_id_t, Player> players;
-    std::map<player_id_t, Position> player_positions;
-    std::set<Position> blocks;
-    std::map<bomb_id_t, Bomb> bombs;
-    std::set<Position> explosions;
-    std::map<player_id_t, score_t> scores;
+    PlayerTable<Player> players;
+    PlayerTable<Position> player_positions;
+    Board blocks;
+    BombTable<Bomb> bombs;
+    Board explosions;
+    PlayerTable<score_t> scores;
+    // Changes made by the last turn, tracked only in delta mode.
+    std::optional<GuiDelta> delta;
 };
 
+// Vectors of an event use the memory resource of the container holding it,
+// so events decoded by the client live in its turn arena.
 class Event {
    public:
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
     EventType event_type{};
     bomb_id_t bomb_id{};
     player_id_t player_id{};
     Position position;
-    std::set<player_id_t> robots_destroyed;
-    std::set<Position> blocks_destroyed;
+    std::pmr::vector<player_id_t> robots_destroyed;
+    std::pmr::vector<Position> blocks_destroyed;
+
+    Event() = default;
+    explicit Event(const allocator_type &allocator)
+        : robots_destroyed(allocator), blocks_destroyed(allocator){};
+    Event(const Event &that, const allocator_type &allocator)
+        : event_type(that.event_type),
+          bomb_id(that.bomb_id),
+          player_id(that.player_id),
+          position(that.position),
+          robots_destroyed(that.robots_destroyed, allocator),
+          blocks_destroyed(that.blocks_destroyed, allocator){};
+    Event(Event &&that, const allocator_type &allocator)
+        : event_type(that.event_type),
+          bomb_id(that.bomb_id),
+          player_id(that.player_id),
+          position(that.position),
+          robots_destroyed(std::move(that.robots_destroyed), allocator),
+          blocks_destroyed(std::move(that.blocks_destroyed), allocator){};
+    Event(const Event &) = default;
+    Event(Event &&) = default;
+    Event &operator=(const Event &) = default;
+    Event &operator=(Event &&) = default;
 };
 
 class GuiInputMessage {
@@ -183,7 +259,27 @@ class ServerMessage {
     Player player;
     std::map<player_id_t, Player> players;
     std::map<player_id_t, score_t> scores;
-    std::vector<Event> events;
+    std::pmr::vector<Event> events;
+
+    ServerMessage() = default;
+    // Events of the message will be decoded into memory of the resource.
+    explicit ServerMessage(std::pmr::memory_resource *resource) : events(resource){};
+
+    // Gives back memory of events to their resource, before it is reset.
+    void release_events() { std::pmr::vector<Event>(events.get_allocator()).swap(events); }
+};
+
+// State of a game after the turn, as known to clients that received all
+// Turn messages until it. Unlike in messages to the GUI, bombs have ids,
+// so the following turns can refer to them.
+class GameSnapshot {
+   public:
+    uint16_t turn{};
+    std::map<player_id_t, Player> players;
+    std::map<player_id_t, Position> player_positions;
+    Board blocks;
+    std::vector<std::pair<bomb_id_t, Bomb>> bombs;
+    std::map<player_id_t, score_t> scores;
 };
 
 #endif  // BOMBERMAN_DEFINITIONS_HPP
@@ -0,0 +1,308 @@
+/* Authoritative simulation of the game run by the server.
+ * All state is kept in flat arrays indexed by player id or in a bitset board,
+ * and every buffer is reused between turns, so after the first few turns
+ * simulating a turn does not allocate. Cost of a turn depends only on the
+ * number of players, bombs and explosion radius, never on the board area. */
+
+#ifndef BOMBERMAN_ENGINE_HPP
+#define BOMBERMAN_ENGINE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "board.hpp"
+#include "definitions.hpp"
+#include "explosion.hpp"
+
+// Action of a player encoded in one byte. Move stores
+// the direction as an offset from MoveAction.
+enum RobotAction : uint8_t {
+    NoAction = 0,
+    BombAction = 1,
+    BlockAction = 2,
+    MoveAction = 3
+};
+
+// Last action of every player received during the current turn.
+// Network handlers overwrite a player's slot with every message, so only
+// the last one counts and a flood of messages costs one store each.
+// Slots are atomic, so they can be written from other threads without locks.
+class InputSlots {
+    static_assert(std::atomic<uint8_t>::is_always_lock_free);
+
+    std::array<std::atomic<uint8_t>, UINT8_MAX + 1> slots{};
+
+   public:
+    void store(player_id_t id, const ClientMessage &message) {
+        uint8_t action = NoAction;
+        switch (message.msg_type) {
+            case PlaceBomb:
+                action = BombAction;
+                break;
+            case PlaceBlock:
+                action = BlockAction;
+                break;
+            case Move:
+                action = (uint8_t)(MoveAction + (uint8_t)message.direction);
+                break;
+            case Join:
+            case EnableFraming:
+                return;
+        }
+        slots[id].store(action, std::memory_order_relaxed);
+    }
+
+    // Returns action of the player and empties the slot.
+    uint8_t take(player_id_t id) { return slots[id].exchange(NoAction, std::memory_order_relaxed); }
+
+    void clear() {
+        for (auto &slot : slots) {
+            slot.store(NoAction, std::memory_order_relaxed);
+        }
+    }
+};
+
+// State of a single robot.
+struct Robot {
+    Position position;
+    bool destroyed{};
+};
+
+// Bomb lying on the board.
+struct ActiveBomb {
+    bomb_id_t id{};
+    Position position;
+    uint16_t timer{};
+};
+
+class GameEngine {
+   private:
+    uint16_t size_x;
+    uint16_t size_y;
+    uint16_t bomb_timer;
+    uint16_t explosion_radius;
+    uint16_t initial_blocks;
+
+    // The only source of randomness in the game. It is reseeded at the start of
+    // every game, so a game is fully determined by its seed and players' actions.
+    std::minstd_rand random;
+
+    uint16_t turn = 0;
+    bomb_id_t next_bomb_id = 0;
+    Board blocks;
+    std::vector<Robot> robots;
+    std::vector<score_t> scores;
+    // Bombs are kept in order of placing, which is also the order of ids.
+    std::vector<ActiveBomb> bombs;
+
+    // Events of the current turn. Slots are reused between turns,
+    // so vectors inside events keep their capacity.
+    std::vector<Event> events;
+    size_t events_count = 0;
+    // Blocks destroyed during current turn, removed after all explosions.
+    std::vector<Position> destroyed_blocks;
+
+    Event &push_event(EventType type) {
+        if (events_count == events.size()) {
+            events.emplace_back();
+        }
+        Event &event = events[events_count++];
+        event.event_type = type;
+        event.robots_destroyed.clear();
+        event.blocks_destroyed.clear();
+        return event;
+    }
+
+    Position random_position() {
+        auto x = (uint16_t)(random() % size_x);
+        auto y = (uint16_t)(random() % size_y);
+        return {x, y};
+    }
+
+    void place_robot(player_id_t id, Position position) {
+        robots[id].position = position;
+        Event &event = push_event(PlayerMoved);
+        event.player_id = id;
+        event.position = position;
+    }
+
+    void explode(const ActiveBomb &bomb) {
+        Event &event = push_event(BombExploded);
+        event.bomb_id = bomb.id;
+
+        ExplosionFootprint footprint =
+            explosion_footprint(blocks, bomb.position, explosion_radius);
+        if (blocks.contains(bomb.position)) {
+            event.blocks_destroyed.push_back(bomb.position);
+        } else {
+            for (auto direction : {Up, Right, Down, Left}) {
+                Position end = footprint.arm_end(direction);
+                if (footprint.arms[direction] > 0 && blocks.contains(end)) {
+                    event.blocks_destroyed.push_back(end);
+                }
+            }
+        }
+        destroyed_blocks.insert(destroyed_blocks.end(), event.blocks_destroyed.begin(),
+                                event.blocks_destroyed.end());
+
+        for (size_t id = 0; id < robots.size(); id++) {
+            Robot &robot = robots[id];
+            if (footprint.contains(robot.position)) {
+                event.robots_destroyed.push_back((player_id_t)id);
+                if (!robot.destroyed) {
+                    robot.destroyed = true;
+                    scores[id]++;
+                }
+            }
+        }
+    }
+
+    void handle_action(player_id_t id, uint8_t action) {
+        Robot &robot = robots[id];
+        switch (action) {
+            case NoAction:
+                break;
+            case BombAction: {
+                ActiveBomb bomb{next_bomb_id++, robot.position, bomb_timer};
+                bombs.push_back(bomb);
+                Event &event = push_event(BombPlaced);
+                event.bomb_id = bomb.id;
+                event.position = bomb.position;
+                break;
+            }
+            case BlockAction:
+                if (blocks.insert(robot.position)) {
+                    Event &event = push_event(BlockPlaced);
+                    event.position = robot.position;
+                }
+                break;
+            default: {
+                int x = robot.position.x;
+                int y = robot.position.y;
+                switch ((Direction)(action - MoveAction)) {
+                    case Up:
+                        y++;
+                        break;
+                    case Right:
+                        x++;
+                        break;
+                    case Down:
+                        y--;
+                        break;
+                    case Left:
+                        x--;
+                        break;
+                }
+                if (x < 0 || y < 0 || x >= size_x || y >= size_y) break;
+                Position target((uint16_t)x, (uint16_t)y);
+                if (!blocks.contains(target)) {
+                    place_robot(id, target);
+                }
+                break;
+            }
+        }
+    }
+
+   public:
+    explicit GameEngine(const server_parameters &settings)
+        : size_x(settings.size_x),
+          size_y(settings.size_y),
+          bomb_timer(settings.bomb_timer),
+          explosion_radius(settings.explosion_radius),
+          initial_blocks(settings.initial_blocks) {}
+
+    // Sets up a new game played with the seed and produces events of turn 0.
+    void start(size_t players_count, uint32_t seed) {
+        random.seed(seed);
+        turn = 0;
+        next_bomb_id = 0;
+        events_count = 0;
+        blocks.resize(size_x, size_y, true);
+        robots.assign(players_count, Robot());
+        scores.assign(players_count, 0);
+        bombs.clear();
+
+        for (size_t id = 0; id < players_count; id++) {
+            place_robot((player_id_t)id, random_position());
+        }
+        for (uint16_t i = 0; i < initial_blocks; i++) {
+            Position position = random_position();
+            if (blocks.insert(position)) {
+                Event &event = push_event(BlockPlaced);
+                event.position = position;
+            }
+        }
+    }
+
+    // Simulates next turn. Slots of all players are drained in one pass,
+    // actions of robots destroyed in this turn are dropped.
+    void play_turn(InputSlots &inputs) {
+        events_count = 0;
+        destroyed_blocks.clear();
+        for (auto &robot : robots) {
+            robot.destroyed = false;
+        }
+
+        size_t remaining = 0;
+        for (auto &bomb : bombs) {
+            bomb.timer--;
+            if (bomb.timer == 0) {
+                explode(bomb);
+            } else {
+                bombs[remaining++] = bomb;
+            }
+        }
+        bombs.resize(remaining);
+
+        for (auto position : destroyed_blocks) {
+            blocks.erase(position);
+        }
+
+        for (size_t id = 0; id < robots.size(); id++) {
+            uint8_t action = inputs.take((player_id_t)id);
+            if (robots[id].destroyed) {
+                place_robot((player_id_t)id, random_position());
+            } else {
+                handle_action((player_id_t)id, action);
+            }
+        }
+        turn++;
+    }
+
+    [[nodiscard]] uint16_t get_turn() const { return turn; }
+
+    // Events produced by the last call to start or play_turn.
+    [[nodiscard]] std::span<const Event> get_events() const {
+        return {events.data(), events_count};
+    }
+
+    [[nodiscard]] std::map<player_id_t, score_t> get_scores() const {
+        std::map<player_id_t, score_t> result;
+        for (size_t id = 0; id < scores.size(); id++) {
+            result[(player_id_t)id] = scores[id];
+        }
+        return result;
+    }
+
+    // Fills snapshot with the state after the last turn, except for players.
+    void fill_snapshot(GameSnapshot &snapshot) const {
+        snapshot.turn = turn;
+        snapshot.player_positions.clear();
+        for (size_t id = 0; id < robots.size(); id++) {
+            snapshot.player_positions[(player_id_t)id] = robots[id].position;
+        }
+        snapshot.blocks = blocks;
+        snapshot.bombs.clear();
+        for (const auto &bomb : bombs) {
+            snapshot.bombs.emplace_back(bomb.id, Bomb(bomb.position, bomb.timer));
+        }
+        snapshot.scores = get_scores();
+    }
+};
+
+#endif  // BOMBERMAN_ENGINE_HPP
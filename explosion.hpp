@@ -0,0 +1,78 @@
+/* Explosion footprint kernel shared by the client and the server engine,
+ * so both sides always agree on which cells were reached by an explosion. */
+
+#ifndef BOMBERMAN_EXPLOSION_HPP
+#define BOMBERMAN_EXPLOSION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "board.hpp"
+#include "definitions.hpp"
+
+// Cells reached by an explosion: a cross centered at the bomb.
+struct ExplosionFootprint {
+    Position center;
+    // Number of cells reached in each direction, indexed by Direction.
+    std::array<uint16_t, 4> arms{};
+
+    [[nodiscard]] bool contains(Position p) const {
+        if (p.y == center.y) {
+            return p.x + arms[Left] >= center.x && p.x <= center.x + arms[Right];
+        }
+        if (p.x == center.x) {
+            return p.y + arms[Down] >= center.y && p.y <= center.y + arms[Up];
+        }
+        return false;
+    }
+
+    // Position of the last cell reached in given direction.
+    [[nodiscard]] Position arm_end(Direction direction) const {
+        switch (direction) {
+            case Up:
+                return {center.x, (uint16_t)(center.y + arms[Up])};
+            case Right:
+                return {(uint16_t)(center.x + arms[Right]), center.y};
+            case Down:
+                return {center.x, (uint16_t)(center.y - arms[Down])};
+            case Left:
+                return {(uint16_t)(center.x - arms[Left]), center.y};
+        }
+        return center;
+    }
+};
+
+// Computes cells reached by explosion of a bomb at center. Explosion goes
+// radius cells in every direction, stops at the edge of the board and at the
+// first block, which is reached as well. A bomb lying on a block reaches
+// only its own cell. Blocks are found with word scans of rows and columns.
+ExplosionFootprint explosion_footprint(const Board &blocks, Position center, uint16_t radius) {
+    ExplosionFootprint footprint;
+    footprint.center = center;
+    if (blocks.contains(center)) return footprint;
+
+    auto arm = [radius](uint16_t to_edge, uint16_t to_block) {
+        return to_block != 0 ? to_block : std::min(radius, to_edge);
+    };
+    footprint.arms[Up] = arm((uint16_t)(blocks.get_size_y() - 1 - center.y),
+                             blocks.column_distance(center, radius, true));
+    footprint.arms[Down] = arm(center.y, blocks.column_distance(center, radius, false));
+    footprint.arms[Right] = arm((uint16_t)(blocks.get_size_x() - 1 - center.x),
+                                blocks.row_distance(center, radius, true));
+    footprint.arms[Left] = arm(center.x, blocks.row_distance(center, radius, false));
+    return footprint;
+}
+
+// Marks all cells of the footprint on the board. The column is set
+// with word operations, the row one cell per column.
+void mark_explosion(Board &explosions, const ExplosionFootprint &footprint) {
+    Position center = footprint.center;
+    explosions.insert_column(center.x, (uint16_t)(center.y - footprint.arms[Down]),
+                             (uint16_t)(center.y + footprint.arms[Up] + 1));
+    for (int x = center.x - footprint.arms[Left]; x <= center.x + footprint.arms[Right]; x++) {
+        explosions.insert({(uint16_t)x, center.y});
+    }
+}
+
+#endif  // BOMBERMAN_EXPLOSION_HPP
@@ -1,43 +1,79 @@
 #ifndef BOMBERMAN_GAME_HPP
 #define BOMBERMAN_GAME_HPP
 
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "buffer.hpp"
 #include "definitions.hpp"
+#include "engine.hpp"
+#include "scheduler.hpp"
 #include "serialization.hpp"
+#include "session.hpp"
+#include "spectators.hpp"
 #include "utils.hpp"
 
 using boost::asio::ip::tcp;
 
-std::string address_from_socket(tcp::socket &socket) {
-    std::string s = socket.remote_endpoint().address().to_string();
-    uint16_t client_port = socket.remote_endpoint().port();
-    std::string client_port_string = std::to_string(client_port);
-    s.append(":");
-    s.append(client_port_string);
-    return s;
-}
-
+// Single game instance. All its sessions and timers use one io_context,
+// which is run by one thread, so the game does not need any locks.
 class Game {
+   public:
+    using game_handler = std::function<void(Game *)>;
+
    private:
     server_parameters game_settings;
+    size_t game_id;
+
+    boost::asio::io_context &io_context;
+    TurnScheduler scheduler{io_context, std::chrono::milliseconds(game_settings.turn_duration)};
 
-    boost::asio::io_context io_context;
-    tcp::acceptor acceptor{io_context, tcp::endpoint(tcp::v6(), game_settings.port)};
+    // Called when the lobby is full and the game starts.
+    game_handler on_started;
+    // Called when the game ends and its clients wait in a new lobby.
+    game_handler on_reopened;
+    // Called when the lobby is left without any clients.
+    game_handler on_idle;
+    // Gets all broadcast messages if spectators are served.
+    SpectatorFeed *spectators;
+    // Spectators with later subscriptions did not see the game from its start.
+    uint64_t spectators_caught_up = 0;
+
+    std::set<std::shared_ptr<Session>> sessions;
+    bool game_in_progress = false;
+    // New clients are taken only while the lobby waits for players.
+    // Clients reaching a game that started or was left by everyone
+    // belong to the lobby of another game.
+    bool lobby_closed = false;
+    GameEngine engine{game_settings};
 
-    uint8_t connected_players;
     player_id_t curr_id;
     std::map<player_id_t, Player> players;
-    ServerMessage server_message;
-    ClientMessage client_message;
-    std::map<player_id_t, score_t> scores;
+    // Number of games played in the lobby, each one gets a different seed.
+    uint64_t games_played = 0;
+
+    // Deepest output queue of clients, sampled after every turn is queued.
+    size_t queue_samples = 0;
+    size_t queued_bytes_sum = 0;
+    size_t queued_bytes_max = 0;
+    size_t queued_messages_max = 0;
+    InputSlots player_inputs;
+    // Messages broadcast since the lobby was opened. They are sent to clients
+    // connecting later, so they see players already accepted. They are kept
+    // only until the game starts, as no new clients come during the game.
+    std::vector<SharedBytes> history;
+
+    SharedBytes hello_message;
 
     [[nodiscard]] ServerMessage create_hello_message() const {
         ServerMessage msg;
@@ -71,104 +107,238 @@ class Game {
     ServerMessage create_game_ended_message() {
         ServerMessage msg;
         msg.msg_type = GameEnded;
-        msg.scores = scores;
+        msg.scores = engine.get_scores();
         return msg;
     }
 
-    ServerMessage create_turn_message(uint16_t turn) {
-        ServerMessage msg;
-        msg.msg_type = Turn;
-        msg.turn = turn;
-        msg.events = {};
-
-        for (auto player : players) {
-            Event event;
-            event.event_type = PlayerMoved;
-            event.position = {static_cast<uint16_t>(turn % game_settings.size_x),
-                              static_cast<uint16_t>(turn % game_settings.size_y)};
-            msg.events.push_back(event);
+    // Every message is encoded once, into bytes of its exact size,
+    // and then shared by all sessions.
+    template <typename Message>
+    SharedBytes encode(const Message &message) {
+        return encodeShared(message);
+    }
+
+    // Encodes turn straight from engine events, without copying them.
+    SharedBytes encode_turn_message() {
+        return encodeShared((uint8_t)Turn, engine.get_turn(), engine.get_events());
+    }
+
+    void publish(const SharedBytes &message) {
+        if (spectators != nullptr) spectators->publish(game_id, message);
+    }
+
+    // Sends state of the game to spectators that subscribed since the last turn.
+    void catch_up_spectators() {
+        if (spectators == nullptr) return;
+        uint64_t subscriptions = spectators->get_subscriptions();
+        if (subscriptions == spectators_caught_up) return;
+        GameSnapshot snapshot;
+        snapshot.players = players;
+        engine.fill_snapshot(snapshot);
+        spectators->publish_to_later(game_id, encode(snapshot), spectators_caught_up);
+        spectators_caught_up = subscriptions;
+    }
+
+    // Sends message to every connected client and remembers it for latecomers
+    // if the lobby is still open.
+    void broadcast(const SharedBytes &message) {
+        for (const auto &session : sessions) {
+            session->send(message);
         }
-        for (uint16_t i = 0; i < game_settings.initial_blocks; i++) {
-            Event event;
-            event.event_type = BlockPlaced;
-            event.position = {static_cast<uint16_t>(turn % game_settings.size_x),
-                              static_cast<uint16_t>(turn % game_settings.size_y)};
-            msg.events.push_back(event);
+        publish(message);
+        if (!lobby_closed) history.push_back(message);
+    }
+
+    // Writes whole line at once, so logs of games running
+    // on different threads do not get mixed up.
+    void log(const std::string &text) const {
+        std::cout << "Game " + std::to_string(game_id) + ": " + text + '\n';
+    }
+
+    void accept_player(const std::shared_ptr<Session> &session, const std::string &player_name) {
+        Player new_player = {player_name, session->get_address()};
+        session->player_id = curr_id;
+        players.insert({curr_id, new_player});
+        log("Accepted player " + player_name + " from " + session->get_address());
+        broadcast(encode(create_accepted_player_message(new_player)));
+
+        if (players.size() == game_settings.players_count) {
+            start_game();
         }
+    }
 
-        return msg;
+    // Seed of the next game played in the lobby, different for every game
+    // and every rematch. The first game of the first lobby uses the seed
+    // from the command line, so a logged seed can be replayed with it.
+    [[nodiscard]] uint32_t next_game_seed() const {
+        uint64_t mixed = game_id * 0x9e3779b97f4a7c15 ^ games_played * 0xc2b2ae3d27d4eb4f;
+        return game_settings.seed + (uint32_t)(mixed ^ mixed >> 32);
+    }
+
+    void start_game() {
+        uint32_t seed = next_game_seed();
+        games_played++;
+        queue_samples = queued_bytes_sum = queued_bytes_max = queued_messages_max = 0;
+        log("Starting game with seed " + std::to_string(seed));
+        game_in_progress = true;
+        lobby_closed = true;
+        history.clear();
+        history.shrink_to_fit();
+        if (spectators != nullptr) spectators_caught_up = spectators->get_subscriptions();
+        on_started(this);
+        broadcast(encode(create_game_started_message()));
+        scheduler.start(game_settings.game_length);
+        engine.start(players.size(), seed);
+        send_turn();
     }
 
-    void handle_connection() {
-        tcp::socket socket(io_context);
-        TCPBuffer buffer(socket);
-        acceptor.accept(socket);
-
-        buffer << create_hello_message();
-        buffer.sendMsg();
-
-        std::string client_address = address_from_socket(socket);
-        std::cout << "Client " << client_address << " connected!\n";
-
-        while (true) {
-            buffer >> client_message;
-            std::cout << "Received ";
-            switch (client_message.msg_type) {
-                case Join:
-                    std::cout << "Join " << client_message.player_name;
-                    if (connected_players < game_settings.players_count) {
-                        Player new_player = {client_message.player_name, client_address};
-                        players.insert({curr_id, new_player});
-                        buffer << create_accepted_player_message(new_player);
-                        buffer.sendMsg();
-                    }
-                    break;
-                case PlaceBomb:
-                    std::cout << "Place Bomb";
-                    break;
-                case PlaceBlock:
-                    std::cout << "Place Block";
-                    break;
-                case Move:
-                    std::cout << "Move ";
-                    printDirection(client_message.direction);
-                    break;
+    // Broadcasts events of the last simulated turn and schedules the next one.
+    void send_turn() {
+        broadcast(encode_turn_message());
+        sample_output_queues();
+        catch_up_spectators();
+
+        if (engine.get_turn() == game_settings.game_length) {
+            end_game();
+            return;
+        }
+        scheduler.schedule_next([this]() {
+            engine.play_turn(player_inputs);
+            send_turn();
+        });
+    }
+
+    void end_game() {
+        std::ostringstream statistics;
+        scheduler.print_statistics(statistics);
+        print_output_statistics(statistics);
+        std::string text = statistics.str();
+        text.pop_back();
+        log("Game ended\n" + text);
+        SharedBytes game_ended = encode(create_game_ended_message());
+        for (const auto &session : sessions) {
+            session->send(game_ended);
+            session->player_id.reset();
+        }
+        publish(game_ended);
+        game_in_progress = false;
+        curr_id = 0;
+        players.clear();
+        player_inputs.clear();
+        if (sessions.empty()) {
+            on_idle(this);
+        } else {
+            // Clients still connected wait for the next game, which new
+            // clients can join too.
+            lobby_closed = false;
+            on_reopened(this);
+        }
+    }
+
+    void sample_output_queues() {
+        size_t bytes = 0;
+        size_t messages = 0;
+        for (const auto &session : sessions) {
+            bytes = std::max(bytes, session->get_output_bytes());
+            messages = std::max(messages, session->get_output_messages());
+        }
+        queue_samples++;
+        queued_bytes_sum += bytes;
+        queued_bytes_max = std::max(queued_bytes_max, bytes);
+        queued_messages_max = std::max(queued_messages_max, messages);
+    }
+
+    // Prints depth of output queues after turns and the longest output queue
+    // of connected clients.
+    void print_output_statistics(std::ostream &out) const {
+        out << "Deepest output queue after turns: mean "
+            << (queue_samples ? (double)queued_bytes_sum / (double)queue_samples : 0.0)
+            << " bytes, max " << queued_bytes_max << " bytes, max " << queued_messages_max
+            << " messages\n";
+        size_t peak_bytes = 0;
+        std::string slowest;
+        for (const auto &session : sessions) {
+            if (session->get_peak_output_bytes() > peak_bytes) {
+                peak_bytes = session->get_peak_output_bytes();
+                slowest = session->get_address();
             }
-            std::cout << '\n';
-            if (client_message.msg_type == Join) break;
         }
+        out << "Longest output queue: " << peak_bytes << " bytes";
+        if (!slowest.empty()) out << " (" << slowest << ")";
+        out << '\n';
+    }
+
+    void handle_message(const std::shared_ptr<Session> &session, const ClientMessage &message) {
+        if (message.msg_type == Join) {
+            if (!game_in_progress && !session->player_id.has_value() &&
+                players.size() < game_settings.players_count) {
+                accept_player(session, message.player_name);
+            }
+        } else if (game_in_progress && session->player_id.has_value()) {
+            player_inputs.store(*session->player_id, message);
+        }
+    }
 
-        std::cout << "Sending game started to " << client_address << '\n';
-        buffer << create_game_started_message();
-        buffer.sendMsg();
-        for (int i = 0; i < game_settings.game_length; i++) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(game_settings.turn_duration));
-            std::cout << "Sending turn " << i << " to " << client_address << '\n';
-            buffer << create_turn_message((uint16_t)i);
-            buffer.sendMsg();
+    void handle_close(const std::shared_ptr<Session> &session) {
+        log("Client " + session->get_address() + " disconnected");
+        sessions.erase(session);
+        if (sessions.empty() && !game_in_progress) {
+            lobby_closed = true;
+            on_idle(this);
         }
-        std::cout << "Sending game ended to " << client_address << '\n';
-        buffer << create_game_ended_message();
-        buffer.sendMsg();
     }
 
    public:
-    explicit Game(server_parameters &settings) : game_settings(settings) {
-        connected_players = 0;
+    Game(const server_parameters &settings,
+         size_t id,
+         boost::asio::io_context &context,
+         game_handler started_h,
+         game_handler reopened_h,
+         game_handler idle_h,
+         SpectatorFeed *spectator_feed)
+        : game_settings(settings),
+          game_id(id),
+          io_context(context),
+          on_started(std::move(started_h)),
+          on_reopened(std::move(reopened_h)),
+          on_idle(std::move(idle_h)),
+          spectators(spectator_feed) {
         curr_id = 0;
+        hello_message = encode(create_hello_message());
+        publish(hello_message);
     };
 
-    void run_game() {
-        std::cout << "Accepting connections on port " << game_settings.port << '\n';
+    Game(const Game &) = delete;
+    Game &operator=(const Game &) = delete;
 
-        try {
-            while (true) {
-                handle_connection();
-            }
-        } catch (std::exception &e) {
-            std::cerr << "error: " << e.what() << '\n';
-            run_game();
+    ~Game() {
+        if (spectators != nullptr) spectators->remove_game(game_id);
+    }
+
+    [[nodiscard]] size_t get_id() const { return game_id; }
+
+    [[nodiscard]] boost::asio::io_context &get_io_context() const { return io_context; }
+
+    // Whether new clients can still join the lobby.
+    // Has to be called from the thread running the game's io_context.
+    [[nodiscard]] bool is_open() const { return !lobby_closed; }
+
+    // Starts session of new client and sends it everything it missed.
+    // Has to be called from the thread running the game's io_context.
+    void handle_connection(const std::shared_ptr<Session> &session) {
+        log("Client " + session->get_address() + " connected!");
+
+        sessions.insert(session);
+        session->set_output_limit(game_settings.output_limit);
+        session->send(hello_message);
+        for (const auto &message : history) {
+            session->send(message);
         }
+        session->start(
+            [this](const std::shared_ptr<Session> &s, const ClientMessage &m) {
+                handle_message(s, m);
+            },
+            [this](const std::shared_ptr<Session> &s) { handle_close(s); });
     }
 };
 
@@ -0,0 +1,568 @@
+// Headless benchmark of the server game engine. It simulates games
+// with synthetic players and no sockets, as fast as possible.
+// In codec mode it measures encoding and decoding of messages instead,
+// and can check that the client does them without heap allocations.
+// In network mode it plays games on a running server with synthetic clients,
+// optionally followed by rematches in which one player of every game leaves.
+
+// Boost 1.74 asio uses std::exchange without including <utility> itself.
+#include <utility>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "buffer.hpp"
+#include "definitions.hpp"
+#include "engine.hpp"
+#include "serialization.hpp"
+#include "utils.hpp"
+
+namespace po = boost::program_options;
+using boost::asio::ip::tcp;
+
+/* Counting of heap allocations made by the whole program. */
+
+static size_t allocations_count = 0;
+
+// Replacements are not inlined, so the compiler does not pair
+// malloc and free with new and delete at call sites.
+__attribute__((noinline)) void *operator new(size_t size) {
+    allocations_count++;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept { free(p); }
+
+__attribute__((noinline)) void operator delete(void *p, [[maybe_unused]] size_t size) noexcept {
+    free(p);
+}
+
+// Struct for storing data from the command line.
+struct bench_parameters {
+    server_parameters game;
+    uint32_t turns{};
+    uint32_t warmup_turns{};
+    std::string input;
+    std::string mode;
+    std::string server_address;
+    uint32_t games{};
+    bool rematch{};
+    bool check_allocations{};
+};
+
+// Create benchmark settings from command line params.
+// If params are incorrect specify error message and exit.
+// If parameter -h [--help] was passed - produce help message.
+bench_parameters check_parameters_and_fill_settings(int argc, char *argv[]) {
+    bench_parameters launch_settings;
+
+    uint16_t players_count_u16;
+    try {
+        po::options_description description("Allowed options");
+
+        description.add_options()("help,h", "produce help message")(
+            "bomb-timer,b",
+            po::value<uint16_t>(&launch_settings.game.bomb_timer)->default_value(5),
+            "set bomb timer")("players-count,c",
+                              po::value<uint16_t>(&players_count_u16)->default_value(8),
+                              "set number of synthetic players")(
+            "explosion-radius,e",
+            po::value<uint16_t>(&launch_settings.game.explosion_radius)->default_value(4),
+            "set explosion radius")(
+            "initial-blocks,k",
+            po::value<uint16_t>(&launch_settings.game.initial_blocks)->default_value(500),
+            "set the amount of blocks placed at game start")(
+            "turns,l", po::value<uint32_t>(&launch_settings.turns)->default_value(100000),
+            "set number of measured turns")(
+            "warmup,w", po::value<uint32_t>(&launch_settings.warmup_turns)->default_value(1000),
+            "set number of turns simulated before measuring")(
+            "seed,s", po::value<uint32_t>(&launch_settings.game.seed)->default_value(0),
+            "set game seed")(
+            "size-x,x", po::value<uint16_t>(&launch_settings.game.size_x)->default_value(100),
+            "set size-x - horizontal dimension of board")(
+            "size-y,y", po::value<uint16_t>(&launch_settings.game.size_y)->default_value(100),
+            "set size-y - vertical dimension of board")(
+            "input,i", po::value<std::string>(&launch_settings.input)->default_value("random"),
+            "set players' input: random or script")(
+            "mode,m", po::value<std::string>(&launch_settings.mode)->default_value("engine"),
+            "set what is measured: engine, codec or network")(
+            "server-address,a",
+            po::value<std::string>(&launch_settings.server_address)
+                ->default_value("localhost:2022"),
+            "set address of the server played on in network mode")(
+            "games,g", po::value<uint32_t>(&launch_settings.games)->default_value(100),
+            "set number of games played at once in network mode")(
+            "rematch,R", po::bool_switch(&launch_settings.rematch),
+            "in network mode play a rematch of every game, in which one player leaves "
+            "and a new client takes the place")(
+            "check-allocations,C", po::bool_switch(&launch_settings.check_allocations),
+            "fail in codec mode if decoding or encoding allocates after warmup");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, description), vm);
+
+        if (vm.count("help")) {
+            std::cout << "Usage: ./robots-bench [options]\n";
+            std::cout << description;
+            exit(EXIT_SUCCESS);
+        }
+
+        po::notify(vm);
+        launch_settings.game.players_count = (uint8_t)players_count_u16;
+        if (launch_settings.input != "random" && launch_settings.input != "script") {
+            throw std::invalid_argument("input has to be random or script");
+        }
+        if (launch_settings.mode != "engine" && launch_settings.mode != "codec" &&
+            launch_settings.mode != "network") {
+            throw std::invalid_argument("mode has to be engine, codec or network");
+        }
+        if (launch_settings.game.size_x == 0 || launch_settings.game.size_y == 0) {
+            throw std::invalid_argument("board can not be empty");
+        }
+    } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    } catch (...) {
+        std::cerr << "Exception of unknown type!\n";
+        exit(EXIT_FAILURE);
+    }
+
+    return launch_settings;
+}
+
+// Produces actions of synthetic players, the same for the same seed.
+class SyntheticPlayers {
+    bool scripted;
+    size_t players_count;
+    std::minstd_rand random;
+    uint64_t turn = 0;
+
+    // Every scripted robot walks in a square, leaving bombs and blocks.
+    static constexpr ClientMessageEnum script_types[] = {Move, Move, PlaceBomb, Move,
+                                                         Move, PlaceBlock};
+    static constexpr Direction script_directions[] = {Up, Right, Up, Down, Left, Up};
+
+   public:
+    SyntheticPlayers(bool s, size_t count, uint32_t seed)
+        : scripted(s), players_count(count), random(seed) {}
+
+    void fill(InputSlots &inputs) {
+        ClientMessage message;
+        for (size_t id = 0; id < players_count; id++) {
+            if (scripted) {
+                size_t step = (turn + id) % std::size(script_types);
+                message.msg_type = script_types[step];
+                message.direction = script_directions[step];
+            } else {
+                message.msg_type = (ClientMessageEnum)(1 + random() % 3);
+                message.direction = (Direction)(random() % 4);
+            }
+            inputs.store((player_id_t)id, message);
+        }
+        turn++;
+    }
+};
+
+// Prints parameters of simulated games.
+void print_settings(const bench_parameters &settings) {
+    std::cout << "Board " << settings.game.size_x << "x" << settings.game.size_y << ", "
+              << (int)settings.game.players_count << " players, "
+              << settings.game.initial_blocks << " initial blocks, explosion radius "
+              << settings.game.explosion_radius << ", " << settings.input << " input\n";
+}
+
+// Prints time and throughput of processing messages.
+void print_codec_result(const std::string &name,
+                        size_t messages,
+                        size_t bytes,
+                        size_t allocations,
+                        double seconds) {
+    std::cout << name << ": " << messages << " messages, "
+              << seconds * 1e9 / (double)messages << " ns per message, "
+              << (double)bytes / seconds / 1e6 << " MB/s, "
+              << (double)allocations / (double)messages << " allocations per message\n";
+}
+
+// Measures decoding of turn messages, as done by the client, and encoding
+// of the game state it sends to the GUI after every turn. Returns number
+// of heap allocations made by measured turns, which come after warmup.
+size_t run_codec_benchmark(const bench_parameters &settings) {
+    GameEngine engine(settings.game);
+    InputSlots inputs;
+    SyntheticPlayers players(settings.input == "script", settings.game.players_count,
+                             settings.game.seed + 1);
+
+    // All turns of the game are encoded one after another, like in a stream.
+    MemoryBuffer stream;
+    engine.start(settings.game.players_count, settings.game.seed);
+    for (uint32_t i = 0; i < settings.warmup_turns + settings.turns; i++) {
+        players.fill(inputs);
+        engine.play_turn(inputs);
+        stream << (uint8_t)Turn << engine.get_turn() << engine.get_events();
+    }
+
+    // State of a game in progress with blocks and explosions all over the board.
+    std::minstd_rand random(settings.game.seed);
+    MessageToGui state;
+    state.msg_type = Game;
+    state.server_name = "Benchmark";
+    state.size_x = settings.game.size_x;
+    state.size_y = settings.game.size_y;
+    state.blocks.resize(state.size_x, state.size_y, true);
+    state.explosions.resize(state.size_x, state.size_y);
+    auto random_position = [&]() {
+        return Position((uint16_t)(random() % state.size_x), (uint16_t)(random() % state.size_y));
+    };
+    for (uint16_t i = 0; i < settings.game.initial_blocks; i++) {
+        state.blocks.insert(random_position());
+        state.explosions.insert(random_position());
+    }
+    for (player_id_t id = 0; id < settings.game.players_count; id++) {
+        state.players[id] = Player("Player " + std::to_string(id), "127.0.0.1:10000");
+        state.player_positions[id] = random_position();
+        state.scores[id] = id;
+        state.bombs[id] = Bomb(random_position(), settings.game.bomb_timer);
+    }
+
+    // Turns are decoded into memory of an arena, like the client does.
+    TurnArena arena;
+    ServerMessage message(&arena);
+    auto decode = [&]() {
+        message.release_events();
+        arena.reset();
+        stream >> message;
+    };
+    for (uint32_t i = 0; i < settings.warmup_turns; i++) {
+        decode();
+    }
+
+    size_t warmup_bytes = stream.readPosition();
+    size_t allocations_before = allocations_count;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < settings.turns; i++) {
+        decode();
+    }
+    auto end = std::chrono::steady_clock::now();
+    size_t allocations = allocations_count - allocations_before;
+    size_t total_allocations = allocations;
+
+    print_settings(settings);
+    print_codec_result("Turn decoding", settings.turns, stream.readPosition() - warmup_bytes,
+                       allocations, std::chrono::duration<double>(end - start).count());
+    if (settings.check_allocations) {
+        std::cout << "Turn arena capacity after warmup: " << arena.get_capacity() << " bytes\n";
+    }
+
+    MemoryBuffer encoder;
+    encoder << state;
+    size_t bytes = 0;
+    allocations_before = allocations_count;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < settings.turns; i++) {
+        encoder.clear();
+        encoder << state;
+        bytes += encoder.length();
+    }
+    end = std::chrono::steady_clock::now();
+    allocations = allocations_count - allocations_before;
+    total_allocations += allocations;
+
+    print_codec_result("GUI state encoding", settings.turns, bytes, allocations,
+                       std::chrono::duration<double>(end - start).count());
+
+    // Same state encoded into bytes sized before encoding, like the client does.
+    std::vector<char> datagram;
+    encodeInto(datagram, state);
+    bytes = 0;
+    allocations_before = allocations_count;
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < settings.turns; i++) {
+        encodeInto(datagram, state);
+        bytes += datagram.size();
+    }
+    end = std::chrono::steady_clock::now();
+    allocations = allocations_count - allocations_before;
+    total_allocations += allocations;
+
+    print_codec_result("GUI state encoding (sized)", settings.turns, bytes, allocations,
+                       std::chrono::duration<double>(end - start).count());
+    return total_allocations;
+}
+
+// Measures simulation of turns by the engine and their encoding.
+void run_engine_benchmark(const bench_parameters &settings) {
+    GameEngine engine(settings.game);
+    InputSlots inputs;
+    SyntheticPlayers players(settings.input == "script", settings.game.players_count,
+                             settings.game.seed + 1);
+    // Turns are encoded like the server does before broadcasting them.
+    std::vector<char> encoded_turn;
+
+    auto simulate = [&]() {
+        players.fill(inputs);
+        engine.play_turn(inputs);
+        encodeInto(encoded_turn, (uint8_t)Turn, engine.get_turn(), engine.get_events());
+        return engine.get_events().size();
+    };
+
+    engine.start(settings.game.players_count, settings.game.seed);
+    for (uint32_t i = 0; i < settings.warmup_turns; i++) {
+        simulate();
+    }
+
+    size_t events = 0;
+    size_t bytes = 0;
+    size_t allocations_before = allocations_count;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < settings.turns; i++) {
+        events += simulate();
+        bytes += encoded_turn.size();
+    }
+    auto end = std::chrono::steady_clock::now();
+    size_t allocations = allocations_count - allocations_before;
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double nanos = seconds * 1e9;
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+
+    print_settings(settings);
+    std::cout << "Turns: " << settings.turns << " in " << seconds << "s\n";
+    std::cout << "Turns per second: " << settings.turns / seconds << '\n';
+    std::cout << "Ns per turn: " << nanos / settings.turns << '\n';
+    std::cout << "Events: " << events
+              << ", ns per event: " << (events ? nanos / (double)events : 0.0) << '\n';
+    std::cout << "Encoded bytes per turn: " << (double)bytes / settings.turns << '\n';
+    std::cout << "Allocations per turn: " << (double)allocations / settings.turns << '\n';
+    std::cout << "Peak memory: " << usage.ru_maxrss << " KiB\n";
+}
+
+// Synthetic client of network mode. It joins a game and moves every turn.
+class BenchClient : public std::enable_shared_from_this<BenchClient> {
+   public:
+    using clock = std::chrono::steady_clock;
+
+   private:
+    tcp::socket socket;
+    MemoryBuffer input;
+    ServerMessage message;
+    std::string join;
+    std::string move;
+    bool closed = false;
+
+    void read() {
+        socket.async_read_some(
+            boost::asio::buffer(input.prepare(4096), 4096),
+            [this, self = shared_from_this()](const boost::system::error_code &error,
+                                              size_t received) {
+                if (error) {
+                    if (!ended && !closed) std::cerr << "error: " << error.message() << '\n';
+                    ended = true;
+                    return;
+                }
+                input.commit(received);
+                handle_input();
+                read();
+            });
+    }
+
+    void handle_input() {
+        while (input.length() > 0) {
+            size_t message_start = input.readPosition();
+            try {
+                input >> message;
+            } catch (incomplete_message &) {
+                input.rewind(message_start);
+                break;
+            }
+            messages++;
+            if (message.msg_type == GameStarted) {
+                started = true;
+            } else if (message.msg_type == Turn) {
+                turn_times[message.turn] = clock::now();
+                boost::asio::write(socket, boost::asio::buffer(move));
+            } else if (message.msg_type == GameEnded) {
+                ended = true;
+            }
+        }
+        bytes += input.readPosition();
+        input.discardRead();
+    }
+
+   public:
+    size_t messages = 0;
+    size_t bytes = 0;
+    bool started = false;
+    bool ended = false;
+    std::map<uint16_t, clock::time_point> turn_times;
+
+    BenchClient(boost::asio::io_context &context, const tcp::endpoint &endpoint, size_t id)
+        : socket(context) {
+        socket.connect(endpoint);
+        socket.set_option(tcp::no_delay(true));
+        MemoryBuffer encoder;
+        ClientMessage client_message;
+        client_message.msg_type = Move;
+        client_message.direction = (Direction)(id % 4);
+        encoder << client_message;
+        move.assign(encoder.data(), encoder.length());
+        encoder.clear();
+        client_message.msg_type = Join;
+        client_message.player_name = "Bench " + std::to_string(id);
+        encoder << client_message;
+        join.assign(encoder.data(), encoder.length());
+        boost::asio::write(socket, boost::asio::buffer(join));
+    }
+
+    void start() { read(); }
+
+    // Joins the next game played in the lobby, after the previous one ended.
+    void rejoin() {
+        started = false;
+        ended = false;
+        turn_times.clear();
+        boost::asio::write(socket, boost::asio::buffer(join));
+    }
+
+    // Disconnects from the server.
+    void leave() {
+        closed = true;
+        boost::system::error_code ignored;
+        socket.shutdown(tcp::socket::shutdown_both, ignored);
+    }
+};
+
+// Plays a rematch of every game played by clients. First player of every
+// game leaves and the others join again, so every lobby reopened by the
+// server after its game waits for one new client.
+void play_rematches(boost::asio::io_context &io_context,
+                    const tcp::endpoint &endpoint,
+                    const std::vector<std::shared_ptr<BenchClient>> &clients,
+                    size_t players) {
+    size_t games = clients.size() / players;
+    std::vector<std::shared_ptr<BenchClient>> playing;
+    auto start = BenchClient::clock::now();
+    for (size_t first = 0; first < clients.size(); first += players) {
+        clients[first]->leave();
+        for (size_t i = first + 1; i < first + players; i++) {
+            clients[i]->rejoin();
+            playing.push_back(clients[i]);
+        }
+    }
+    for (size_t game = 0; game < games; game++) {
+        auto client = std::make_shared<BenchClient>(io_context, endpoint, clients.size() + game);
+        client->start();
+        playing.push_back(client);
+        while (!client->started) io_context.run_one();
+    }
+    auto all_started = BenchClient::clock::now();
+    while (!std::all_of(playing.begin(), playing.end(),
+                        [](const auto &client) { return client->ended; })) {
+        io_context.run_one();
+    }
+    auto end = BenchClient::clock::now();
+
+    std::cout << "Rematches of " << games << " games: lobbies filled in "
+              << std::chrono::duration<double>(all_started - start).count() << "s, games played in "
+              << std::chrono::duration<double>(end - start).count() << "s\n";
+}
+
+// Plays games on a running server, filling lobbies one after another. Turns
+// are sent by the server to all players of a game at once, so the spread of
+// their arrival shows how fast the server sends them.
+void run_network_benchmark(const bench_parameters &settings) {
+    boost::asio::io_context io_context(1);
+    address_info server = get_address_info(settings.server_address);
+    tcp::resolver resolver(io_context);
+    tcp::endpoint endpoint = *resolver.resolve(server.address, server.port);
+
+    size_t players = std::max<size_t>(settings.game.players_count, 1);
+    std::vector<std::shared_ptr<BenchClient>> clients;
+    auto start = BenchClient::clock::now();
+    for (uint32_t game = 0; game < settings.games; game++) {
+        for (size_t i = 0; i < players; i++) {
+            clients.push_back(std::make_shared<BenchClient>(io_context, endpoint, clients.size()));
+            clients.back()->start();
+        }
+        // Next lobby is opened by the server when this game starts.
+        auto started = [&]() {
+            return std::all_of(clients.end() - (ptrdiff_t)players, clients.end(),
+                               [](const auto &client) { return client->started; });
+        };
+        while (!started()) io_context.run_one();
+    }
+    auto all_started = BenchClient::clock::now();
+    while (!std::all_of(clients.begin(), clients.end(),
+                        [](const auto &client) { return client->ended; })) {
+        io_context.run_one();
+    }
+    auto end = BenchClient::clock::now();
+
+    size_t messages = 0;
+    size_t bytes = 0;
+    size_t turns = 0;
+    double spread_sum = 0;
+    double spread_max = 0;
+    for (size_t first = 0; first < clients.size(); first += players) {
+        messages += clients[first]->messages;
+        bytes += clients[first]->bytes;
+        for (const auto &[turn, time] : clients[first]->turn_times) {
+            auto earliest = time;
+            auto latest = time;
+            for (size_t i = first; i < first + players; i++) {
+                auto it = clients[i]->turn_times.find(turn);
+                if (it == clients[i]->turn_times.end()) continue;
+                earliest = std::min(earliest, it->second);
+                latest = std::max(latest, it->second);
+            }
+            double spread = std::chrono::duration<double, std::micro>(latest - earliest).count();
+            spread_sum += spread;
+            spread_max = std::max(spread_max, spread);
+            turns++;
+        }
+    }
+
+    std::cout << settings.games << " games of " << players << " players on "
+              << settings.server_address << '\n';
+    std::cout << "Lobbies filled in "
+              << std::chrono::duration<double>(all_started - start).count() << "s, games played in "
+              << std::chrono::duration<double>(end - start).count() << "s\n";
+    std::cout << "Messages per player: " << (double)messages / (double)settings.games
+              << ", bytes per player: " << (double)bytes / (double)settings.games << '\n';
+    std::cout << "Turn arrival spread between players of a game: mean "
+              << (turns ? spread_sum / (double)turns : 0.0) << " us, max " << spread_max
+              << " us\n";
+
+    if (settings.rematch) play_rematches(io_context, endpoint, clients, players);
+}
+
+int main(int argc, char *argv[]) {
+    bench_parameters settings = check_parameters_and_fill_settings(argc, argv);
+    if (settings.mode == "codec") {
+        size_t allocations = run_codec_benchmark(settings);
+        if (settings.check_allocations && allocations > 0) {
+            std::cerr << "error: " << allocations << " heap allocations after warmup\n";
+            return EXIT_FAILURE;
+        }
+    } else if (settings.mode == "network") {
+        run_network_benchmark(settings);
+    } else {
+        run_engine_benchmark(settings);
+    }
+    return 0;
+}
@@ -1,11 +1,17 @@
+// Boost 1.74 asio uses std::exchange without including <utility> itself.
+#include <utility>
+
 #include <boost/asio.hpp>
+#include <bitset>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <iostream>
 #include <map>
-#include <utility>
 
+#include "arena.hpp"
 #include "buffer.hpp"
 #include "definitions.hpp"
+#include "explosion.hpp"
 #include "serialization.hpp"
 #include "utils.hpp"
 
@@ -25,14 +31,25 @@ struct client_parameters {
     std::string server_address;
     std::string player_name;
     uint16_t port{};
+    bool framing{};
+    bool event_loop{};
+    // Every how many turns gui gets full state in delta mode, 0 disables it.
+    uint16_t keyframe_interval{};
+    // Most updates sent to gui per second, 0 means no limit.
+    uint16_t gui_rate{};
 
     client_parameters() = default;
 
-    client_parameters(std::string ga, std::string sa, std::string pn, uint16_t p)
+    client_parameters(std::string ga, std::string sa, std::string pn, uint16_t p, bool f, bool el,
+                      uint16_t ki, uint16_t gr)
         : gui_address(std::move(ga)),
           server_address(std::move(sa)),
           player_name(std::move(pn)),
-          port(p){};
+          port(p),
+          framing(f),
+          event_loop(el),
+          keyframe_interval(ki),
+          gui_rate(gr){};
 };
 
 // Enum describing current status of the game.
@@ -60,6 +77,8 @@ class ClientInfo {
     tcp::socket server_socket{io_context};
     tcp::endpoint server_endpoint{};
     tcp::resolver TCP_resolver{io_context};
+    // Set when gui asks for full state, cleared when it is sent.
+    std::atomic<bool> keyframe_requested{false};
 
     // Constructor attempts to connect with
     // server specified in command line options.
@@ -89,6 +108,10 @@ client_parameters check_parameters_and_fill_settings(int argc, char *argv[]) {
     std::string server_address;
     std::string player_name;
     uint16_t port = 0;
+    bool framing = false;
+    bool event_loop = false;
+    uint16_t keyframe_interval = 0;
+    uint16_t gui_rate = 0;
 
     try {
         po::options_description description("Allowed options");
@@ -99,7 +122,15 @@ client_parameters check_parameters_and_fill_settings(int argc, char *argv[]) {
             "player-name,n", po::value<std::string>(&player_name)->required(), "set Player name")(
             "server-address,s", po::value<std::string>(&server_address)->required(),
             "specify server address")("port,p", po::value<uint16_t>(&port)->required(),
-                                      "set client port to listen from gui");
+                                      "set client port to listen from gui")(
+            "framing,f", po::bool_switch(&framing),
+            "prefix messages with their length, server has to support it")(
+            "event-loop,e", po::bool_switch(&event_loop),
+            "serve gui and server from one thread with asynchronous operations")(
+            "gui-delta,g", po::value<uint16_t>(&keyframe_interval),
+            "send gui only changes of game state, with full state every given number of turns")(
+            "gui-rate,r", po::value<uint16_t>(&gui_rate),
+            "send gui at most given number of updates per second");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, description), vm);
@@ -119,7 +150,8 @@ client_parameters check_parameters_and_fill_settings(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    auto settings = client_parameters(gui_address, server_address, player_name, port);
+    auto settings = client_parameters(gui_address, server_address, player_name, port, framing,
+                                      event_loop, keyframe_interval, gui_rate);
     return settings;
 }
 
@@ -141,6 +173,16 @@ static ClientMessage JoinMessage(std::string pn) {
     return msg;
 }
 
+// Function produces message to server for GUI input. First input
+// after the client got to the lobby joins the game instead.
+static ClientMessage MessageToServer(const GuiInputMessage &m, const std::string &player_name) {
+    if (game_state == SendJoinMsg) {
+        game_state = InLobby;
+        return JoinMessage(player_name);
+    }
+    return MessageToServerFromGuiMessage(m);
+}
+
 void print_message_from_gui(GuiInputMessage m) {
     std::cerr << "Received ";
     switch (m.msg_type) {
@@ -154,6 +196,9 @@ void print_message_from_gui(GuiInputMessage m) {
             std::cerr << "Move ";
             printDirection(m.direction);
             break;
+        case RequestKeyframeGui:
+            std::cerr << "RequestKeyframe";
+            break;
     }
     std::cerr << " from gui\n";
 }
@@ -167,20 +212,31 @@ void receive_from_gui_send_to_server(ClientInfo &client_info) {
         UDPBuffer udpBuffer(client_info.gui_socket, client_info.gui_endpoint);
         GuiInputMessage msg_from_gui;
         ClientMessage msg_to_server;
+        MemoryBuffer frame;
+
+        // Only this thread writes to the server, so nothing else
+        // can be sent between the request and framed messages.
+        if (client_info.settings.framing) {
+            msg_to_server.msg_type = EnableFraming;
+            tcpBuffer << msg_to_server;
+            tcpBuffer.sendMsg();
+        }
 
         while (true) {
             try {
-                udpBuffer.receiveMsg(0);
+                udpBuffer.receiveMsg();
                 udpBuffer >> msg_from_gui;
 
                 if (debug) print_message_from_gui(msg_from_gui);
+                if (msg_from_gui.msg_type == RequestKeyframeGui) {
+                    client_info.keyframe_requested = true;
+                    continue;
+                }
 
-                if (game_state == SendJoinMsg) {
-                    game_state = InLobby;
-                    msg_to_server = JoinMessage(client_info.settings.player_name);
-                    tcpBuffer << msg_to_server;
+                msg_to_server = MessageToServer(msg_from_gui, client_info.settings.player_name);
+                if (client_info.settings.framing) {
+                    writeFrame(tcpBuffer, frame, msg_to_server);
                 } else {
-                    msg_to_server = MessageToServerFromGuiMessage(msg_from_gui);
                     tcpBuffer << msg_to_server;
                 }
                 tcpBuffer.sendMsg();
@@ -207,11 +263,13 @@ void handle_hello_msg(ServerMessage &server_message, MessageToGui &msg_to_gui) {
     msg_to_gui.game_length = server_message.game_length;
     msg_to_gui.explosion_radius = server_message.explosion_radius;
     msg_to_gui.bomb_timer = server_message.bomb_timer;
+    msg_to_gui.blocks.resize(msg_to_gui.size_x, msg_to_gui.size_y, true);
+    msg_to_gui.explosions.resize(msg_to_gui.size_x, msg_to_gui.size_y);
 }
 
 // Function sets msg_to_gui with appropriate data from accepted player msg.
 void handle_accepted_player(ServerMessage &server_message, MessageToGui &msg_to_gui) {
-    msg_to_gui.players.insert({server_message.player_id, server_message.player});
+    msg_to_gui.players[server_message.player_id] = server_message.player;
     msg_to_gui.scores[server_message.player_id] = 0;
     if (debug)
         std::cerr << "Accepted player " << server_message.player.player_name
@@ -222,89 +280,110 @@ void handle_accepted_player(ServerMessage &server_message, MessageToGui &msg_to_
 void handle_game_started(ServerMessage &server_message, MessageToGui &msg_to_gui) {
     if (debug) std::cerr << "Received GameStarted";
     game_state = InGame;
-    msg_to_gui.players = server_message.players;
+    msg_to_gui.players.assign(server_message.players);
     for (const auto &player : msg_to_gui.players) {
         msg_to_gui.scores[player.first] = 0;
     }
 }
 
-// Function sets msg_to_gui with appropriate data from bomb exploded event.
-// It also adds some elements to dead players and destroyed blocks.
-void handle_bomb_exploded(MessageToGui &msg_to_gui,
-                          std::set<player_id_t> &dead_players,
-                          std::set<Position> &destroyed_blocks,
-                          const Event &event) {
-    Bomb bomb = msg_to_gui.bombs[event.bomb_id];
-    Position pos = bomb.position;
-    msg_to_gui.bombs.erase(event.bomb_id);
-    for (uint16_t i = 0; i <= msg_to_gui.explosion_radius; i++) {
-        if (pos.x + i == msg_to_gui.size_x) break;
-        msg_to_gui.explosions.insert({(uint16_t)(pos.x + i), pos.y});
-        if (msg_to_gui.blocks.contains({(uint16_t)(pos.x + i), pos.y})) break;
-    }
-    for (uint16_t i = 0; i <= msg_to_gui.explosion_radius; i++) {
-        msg_to_gui.explosions.insert({(uint16_t)(pos.x - i), pos.y});
-        if (pos.x - i == 0) break;
-        if (msg_to_gui.blocks.contains({(uint16_t)(pos.x - i), pos.y})) break;
-    }
-    for (uint16_t i = 0; i <= msg_to_gui.explosion_radius; i++) {
-        if (pos.y + i == msg_to_gui.size_y) break;
-        msg_to_gui.explosions.insert({pos.x, (uint16_t)(pos.y + i)});
-        if (msg_to_gui.blocks.contains({pos.x, (uint16_t)(pos.y + i)})) break;
-    }
-    for (uint16_t i = 0; i <= msg_to_gui.explosion_radius; i++) {
-        msg_to_gui.explosions.insert({pos.x, (uint16_t)(pos.y - i)});
-        if (pos.y - i == 0) break;
-        if (msg_to_gui.blocks.contains({pos.x, (uint16_t)(pos.y - i)})) break;
-    }
-
-    for (auto id : event.robots_destroyed) {
-        if (!dead_players.contains(id)) {
-            msg_to_gui.scores[id]++;
-            dead_players.insert(id);
+// Class applying events of a turn to msg_to_gui one at a time, so a turn
+// can be applied while it is read. Destroyed blocks are removed when
+// the turn ends, as they stop the other explosions of the turn too.
+class TurnApplier {
+    std::bitset<PLAYER_IDS> dead_players;
+    std::vector<Position> destroyed_blocks;
+    // Event read from the server, reused so its vectors keep their capacity.
+    Event event;
+
+    void apply_bomb_exploded(MessageToGui &msg_to_gui, const Event &exploded) {
+        Bomb bomb = msg_to_gui.bombs.take(exploded.bomb_id);
+        if (msg_to_gui.delta) msg_to_gui.delta->bombs_exploded.push_back(bomb);
+        mark_explosion(msg_to_gui.explosions,
+                       explosion_footprint(msg_to_gui.blocks, bomb.position,
+                                           msg_to_gui.explosion_radius));
+
+        for (auto id : exploded.robots_destroyed) {
+            if (!dead_players[id]) {
+                msg_to_gui.scores[id]++;
+                dead_players[id] = true;
+                if (msg_to_gui.delta) msg_to_gui.delta->scores[id] = msg_to_gui.scores[id];
+            }
         }
+        destroyed_blocks.insert(destroyed_blocks.end(), exploded.blocks_destroyed.begin(),
+                                exploded.blocks_destroyed.end());
     }
-    for (auto position : event.blocks_destroyed) {
-        destroyed_blocks.insert(position);
+
+   public:
+    // Function starts turn, bombs tick and explosions of the last turn vanish.
+    void begin(MessageToGui &msg_to_gui, uint16_t turn) {
+        if (debug) std::cerr << "Received Turn " << turn;
+        dead_players.reset();
+        destroyed_blocks.clear();
+        for (auto &slot : msg_to_gui.bombs) {
+            slot.value.timer--;
+        }
+        msg_to_gui.explosions.clear();
+        msg_to_gui.msg_type = Game;
+        if (msg_to_gui.delta) {
+            msg_to_gui.delta->clear();
+            msg_to_gui.delta->base_turn = msg_to_gui.turn;
+        }
+        msg_to_gui.turn = turn;
     }
-}
 
-// Function sets msg_to_gui with appropriate data from turn msg.
-void handle_turn(ServerMessage &server_message,
-                 MessageToGui &msg_to_gui,
-                 std::set<player_id_t> &dead_players,
-                 std::set<Position> &destroyed_blocks) {
-    if (debug) std::cerr << "Received Turn " << server_message.turn;
-    for (auto &elem : msg_to_gui.bombs) {
-        elem.second.timer--;
-    }
-    msg_to_gui.explosions.clear();
-    msg_to_gui.msg_type = Game;
-    msg_to_gui.turn = server_message.turn;
-    dead_players.clear();
-    destroyed_blocks.clear();
-    for (const auto &event : server_message.events) {
-        switch (event.event_type) {
+    // Function sets msg_to_gui with appropriate data from event of the turn.
+    void apply(MessageToGui &msg_to_gui, const Event &turn_event) {
+        switch (turn_event.event_type) {
             case BombPlaced: {
-                Bomb bomb(event.position, msg_to_gui.bomb_timer);
-                msg_to_gui.bombs.insert({event.bomb_id, bomb});
+                Bomb bomb(turn_event.position, msg_to_gui.bomb_timer);
+                msg_to_gui.bombs[turn_event.bomb_id] = bomb;
+                if (msg_to_gui.delta) msg_to_gui.delta->bombs_placed.push_back(bomb);
                 break;
             }
-            case BombExploded: {
-                handle_bomb_exploded(msg_to_gui, dead_players, destroyed_blocks, event);
+            case BombExploded:
+                apply_bomb_exploded(msg_to_gui, turn_event);
                 break;
-            }
             case PlayerMoved:
-                msg_to_gui.player_positions[event.player_id] = event.position;
+                msg_to_gui.player_positions[turn_event.player_id] = turn_event.position;
+                if (msg_to_gui.delta) {
+                    msg_to_gui.delta->player_positions[turn_event.player_id] =
+                        turn_event.position;
+                }
                 break;
             case BlockPlaced:
-                msg_to_gui.blocks.insert(event.position);
+                if (msg_to_gui.blocks.insert(turn_event.position) && msg_to_gui.delta) {
+                    msg_to_gui.delta->blocks_placed.push_back(turn_event.position);
+                }
                 break;
         }
     }
-    for (auto position : destroyed_blocks) {
-        msg_to_gui.blocks.erase(position);
+
+    // Function ends turn, removing blocks destroyed by its explosions.
+    void end(MessageToGui &msg_to_gui) {
+        for (auto position : destroyed_blocks) {
+            if (msg_to_gui.blocks.erase(position) && msg_to_gui.delta) {
+                msg_to_gui.delta->blocks_destroyed.push_back(position);
+            }
+        }
+    }
+
+    // Function reads turn following its message type and applies
+    // every event right after it is read.
+    template <typename T>
+    void read_and_apply(Buffer<T> &buffer, MessageToGui &msg_to_gui) {
+        begin(msg_to_gui, buffer.readUint16());
+        readEvents(buffer, event, [&](const Event &read) { apply(msg_to_gui, read); });
+        end(msg_to_gui);
+    }
+};
+
+// Function sets msg_to_gui with appropriate data from turn msg.
+void handle_turn(ServerMessage &server_message, MessageToGui &msg_to_gui, TurnApplier &applier) {
+    applier.begin(msg_to_gui, server_message.turn);
+    for (const auto &event : server_message.events) {
+        applier.apply(msg_to_gui, event);
     }
+    applier.end(msg_to_gui);
 }
 
 // Function sets msg_to_gui with appropriate data from accepted player msg.
@@ -315,15 +394,14 @@ void handle_game_ended(ServerMessage &server_message, MessageToGui &msg_to_gui)
     msg_to_gui.players.clear();
     msg_to_gui.blocks.clear();
     msg_to_gui.bombs.clear();
-    msg_to_gui.scores = server_message.scores;
+    msg_to_gui.scores.assign(server_message.scores);
 }
 
 // Function sets msg_to_gui fields depending on server message.
 // It analyzes server message.
-void message_to_gui_from_server_msg(ServerMessage &server_message, MessageToGui &msg_to_gui) {
-    std::set<player_id_t> dead_players;
-    std::set<Position> destroyed_blocks;
-
+void message_to_gui_from_server_msg(ServerMessage &server_message,
+                                    MessageToGui &msg_to_gui,
+                                    TurnApplier &applier) {
     switch (server_message.msg_type) {
         case Hello:
             handle_hello_msg(server_message, msg_to_gui);
@@ -335,7 +413,7 @@ void message_to_gui_from_server_msg(ServerMessage &server_message, MessageToGui
             handle_game_started(server_message, msg_to_gui);
             break;
         case Turn:
-            handle_turn(server_message, msg_to_gui, dead_players, destroyed_blocks);
+            handle_turn(server_message, msg_to_gui, applier);
             break;
         case GameEnded:
             handle_game_ended(server_message, msg_to_gui);
@@ -347,22 +425,170 @@ void message_to_gui_from_server_msg(ServerMessage &server_message, MessageToGui
     if (debug) std::cerr << " from server\n";
 }
 
+// Function reads message from server and sets msg_to_gui with its data.
+// Events of a turn are applied right after each of them is read, so the
+// turn is never decoded whole. Returns type of the message.
+template <typename T>
+ServerMessageEnum read_server_message(Buffer<T> &buffer,
+                                      ServerMessage &server_message,
+                                      MessageToGui &msg_to_gui,
+                                      TurnApplier &applier) {
+    server_message.msg_type = readServerMessageType(buffer);
+    if (server_message.msg_type == Turn) {
+        applier.read_and_apply(buffer, msg_to_gui);
+        if (debug) std::cerr << " from server\n";
+    } else {
+        readServerMessageBody(buffer, server_message);
+        if (server_message.msg_type != FramingEnabled) {
+            message_to_gui_from_server_msg(server_message, msg_to_gui, applier);
+        }
+    }
+    return server_message.msg_type;
+}
+
+// Class sending messages to gui, each in one datagram. Only the newest state
+// is sent: when more messages from the server are already waiting, they are
+// applied first, so a client that fell behind does not send a backlog of
+// stale states. Updates can also be limited to gui_rate per second.
+// In delta mode turns are sent as GameDelta messages, except for keyframes
+// sent as full Game messages: the first turn after lobby, every
+// keyframe_interval-th turn, the turn after gui asked for one and the turn
+// after skipped ones. Gui that misses a delta can notice it by its base turn
+// and ask for a keyframe.
+class GuiSender {
+    using clock = std::chrono::steady_clock;
+
+    ClientInfo &client_info;
+    // Datagram is sized before encoding, so it is encoded without capacity checks.
+    std::vector<char> datagram;
+    // Whether gui got the previous turn, that the next delta is based on.
+    bool has_base = false;
+    uint16_t deltas_since_keyframe = 0;
+    // Whether state changed since it was last sent.
+    bool pending = false;
+    // Time before which no update is sent, when their rate is limited.
+    clock::time_point next_update;
+
+    // Function chooses how turn is sent in delta mode.
+    MessageToGuiEnum turn_message_type() {
+        bool requested = client_info.keyframe_requested.exchange(false);
+        if (!has_base || requested ||
+            deltas_since_keyframe + 1 >= client_info.settings.keyframe_interval) {
+            deltas_since_keyframe = 0;
+            return Game;
+        }
+        deltas_since_keyframe++;
+        return GameDelta;
+    }
+
+    // Function sends msg_to_gui, in delta mode turn may be sent as GameDelta.
+    void send(MessageToGui &msg_to_gui) {
+        if (msg_to_gui.msg_type == Lobby) {
+            has_base = false;
+        } else if (msg_to_gui.delta) {
+            msg_to_gui.msg_type = turn_message_type();
+            has_base = true;
+        }
+        encodeInto(datagram, msg_to_gui);
+        if (datagram.size() > UDP_BUFF_SIZE) {
+            throw std::length_error("Message does not fit in UDP datagram");
+        }
+        client_info.gui_socket.send_to(boost::asio::buffer(datagram), client_info.gui_endpoint);
+    }
+
+   public:
+    explicit GuiSender(ClientInfo &info) : client_info(info) {}
+
+    // Function makes msg_to_gui track changes of state if delta mode is on.
+    void prepare(MessageToGui &msg_to_gui) const {
+        if (client_info.settings.keyframe_interval > 0) msg_to_gui.delta.emplace();
+    }
+
+    // Function notes that state changed. When the previous change was not
+    // sent, gui misses it and the next delta would have no base.
+    void changed() {
+        if (pending) has_base = false;
+        pending = true;
+    }
+
+    // Function sends the newest state if it changed and the rate limit allows.
+    // Returns whether the state still waits to be sent.
+    bool flush(MessageToGui &msg_to_gui) {
+        if (!pending) return false;
+        auto now = clock::now();
+        if (now < next_update) return true;
+        send(msg_to_gui);
+        pending = false;
+        if (client_info.settings.gui_rate > 0) {
+            next_update = now + std::chrono::nanoseconds(std::chrono::seconds(1)) /
+                                    client_info.settings.gui_rate;
+        }
+        return false;
+    }
+
+    // Returns time when the waiting state can be sent.
+    [[nodiscard]] clock::time_point deadline() const { return next_update; }
+};
+
+// Function gives back memory of the previous message to the arena,
+// so the next message is decoded into the same memory.
+void recycle_server_message(ServerMessage &message, TurnArena &arena) {
+    message.release_events();
+    arena.reset();
+}
+
+// Function sends the newest state to gui, unless a whole message from the
+// server was already received, which would make the state stale. State that
+// waits for the rate limit is sent when its time comes, if the server does
+// not send a whole message first.
+void update_gui(TCPBuffer &buffer, bool framing, GuiSender &to_gui, MessageToGui &msg_to_gui) {
+    auto message_received = [&]() {
+        auto received = buffer.unreadBytes();
+        return framing ? containsFrame(received) : containsServerMessage(received);
+    };
+    if (message_received()) return;
+    buffer.receiveAvailable();
+    while (!message_received() && to_gui.flush(msg_to_gui)) {
+        if (!buffer.waitForInput(to_gui.deadline())) continue;
+        // Readable socket that gives no bytes was closed, or the buffer is full
+        // of a message longer than it. Reading the message handles both.
+        if (!buffer.receiveAvailable()) return;
+    }
+}
+
 // Function works in infinite loop.
 // It receives message from server and parses it.
-// After that if message is correct it sends appropriate message to gui.
+// After that if message is correct it updates state sent to gui.
 void receive_from_server_send_to_gui(ClientInfo &client_info) {
     try {
         TCPBuffer tcpBuffer(client_info.server_socket);
-        UDPBuffer udpBuffer(client_info.gui_socket, client_info.gui_endpoint);
+        GuiSender to_gui(client_info);
         MessageToGui msg_to_gui;
+        to_gui.prepare(msg_to_gui);
         ServerMessage msg_from_server;
+        TurnApplier applier;
+        MemoryBuffer frame;
+        // Server confirms framing with the last message without length prefix.
+        bool framing = false;
         while (true) {
-            tcpBuffer >> msg_from_server;
+            update_gui(tcpBuffer, framing, to_gui, msg_to_gui);
+            if (framing) {
+                readFrame(tcpBuffer, frame);
+                if (!readFromFrame(frame, FramingEnabled, [&](MemoryBuffer &from) {
+                        read_server_message(from, msg_from_server, msg_to_gui, applier);
+                    })) {
+                    continue;
+                }
+            } else {
+                read_server_message(tcpBuffer, msg_from_server, msg_to_gui, applier);
+            }
+            if (msg_from_server.msg_type == FramingEnabled) {
+                framing = true;
+                continue;
+            }
 
-            message_to_gui_from_server_msg(msg_from_server, msg_to_gui);
             if (msg_from_server.msg_type != GameStarted) {
-                udpBuffer << msg_to_gui;
-                udpBuffer.sendMsg();
+                to_gui.changed();
             }
         }
     } catch (std::exception &e) {
@@ -374,11 +600,219 @@ void receive_from_server_send_to_gui(ClientInfo &client_info) {
     }
 }
 
+// Client serving the gui and the server from the thread running io_context,
+// with asynchronous operations on both sockets. It does not start threads,
+// so it can be run by an io_context shared with other work.
+class EventLoopClient {
+    ClientInfo &client_info;
+
+    UDPBuffer from_gui;
+    GuiInputMessage msg_from_gui;
+    MessageToGui msg_to_gui;
+    GuiSender to_gui;
+    // Sends state that waits for the rate limit.
+    boost::asio::steady_timer gui_timer;
+    bool gui_timer_waiting = false;
+
+    MemoryBuffer from_server;
+    TurnArena arena;
+    ServerMessage msg_from_server{&arena};
+    TurnApplier applier;
+    MemoryBuffer frame_from_server;
+    // Server confirms framing with the last message without length prefix.
+    bool framing = false;
+
+    // Messages wait in to_server while the previous ones are being written.
+    MemoryBuffer to_server;
+    MemoryBuffer writing_to_server;
+    MemoryBuffer frame_to_server;
+    bool writing = false;
+
+    [[noreturn]] static void fail(const std::string &reason) {
+        std::cerr << "error " << reason << '\n';
+        exit(EXIT_FAILURE);
+    }
+
+    void send_to_server(const ClientMessage &message) {
+        if (client_info.settings.framing && message.msg_type != EnableFraming) {
+            writeFrame(to_server, frame_to_server, message);
+        } else {
+            to_server << message;
+        }
+        write_to_server();
+    }
+
+    void write_to_server() {
+        if (writing || to_server.length() == 0) return;
+        writing = true;
+        to_server.swap(writing_to_server);
+        boost::asio::async_write(
+            client_info.server_socket,
+            boost::asio::buffer(writing_to_server.data(), writing_to_server.length()),
+            [this](const boost::system::error_code &error, size_t) {
+                if (error) fail(error.message());
+                writing = false;
+                writing_to_server.clear();
+                write_to_server();
+            });
+    }
+
+    void receive_from_gui() {
+        from_gui.asyncReceiveMsg([this](const boost::system::error_code &error) {
+            if (error) {
+                std::cerr << "error " << error.message() << '\n';
+            } else {
+                handle_gui_message();
+            }
+            receive_from_gui();
+        });
+    }
+
+    void handle_gui_message() {
+        try {
+            from_gui >> msg_from_gui;
+        } catch (std::exception &e) {
+            std::cerr << "error " << e.what() << '\n';
+            return;
+        }
+        if (debug) print_message_from_gui(msg_from_gui);
+        if (msg_from_gui.msg_type == RequestKeyframeGui) {
+            client_info.keyframe_requested = true;
+            return;
+        }
+        send_to_server(MessageToServer(msg_from_gui, client_info.settings.player_name));
+    }
+
+    void receive_from_server() {
+        client_info.server_socket.async_read_some(
+            boost::asio::buffer(from_server.prepare(TCP_STREAM_BUFF_SIZE), TCP_STREAM_BUFF_SIZE),
+            [this](const boost::system::error_code &error, size_t received) {
+                if (error == boost::asio::error::eof) fail("Connection closed by peer");
+                if (error) fail(error.message());
+                from_server.commit(received);
+                try {
+                    handle_server_input();
+                } catch (std::exception &e) {
+                    fail(e.what());
+                }
+                receive_from_server();
+            });
+    }
+
+    // Handles all messages received so far, including the ones received
+    // while the others were handled, and sends the newest state to gui.
+    void handle_server_input() {
+        do {
+            handle_received_messages();
+            from_server.discardRead();
+        } while (receive_available());
+        update_gui();
+    }
+
+    // Reads bytes already received by the socket, without blocking.
+    // Returns whether there were any. Errors are left for the next read.
+    bool receive_available() {
+        boost::system::error_code error;
+        size_t available = client_info.server_socket.available(error);
+        if (available == 0) return false;
+        size_t received = client_info.server_socket.read_some(
+            boost::asio::buffer(from_server.prepare(available), available), error);
+        if (error) return false;
+        from_server.commit(received);
+        return true;
+    }
+
+    // Handles complete messages in the buffer. Incomplete message is left
+    // in the buffer until more bytes arrive. Framed turns are complete
+    // once their frame is, so they are applied while read. Unframed ones
+    // are decoded whole first, as their events could not be read again
+    // after being applied to the state.
+    void handle_received_messages() {
+        while (from_server.length() > 0) {
+            size_t message_start = from_server.readPosition();
+            recycle_server_message(msg_from_server, arena);
+            try {
+                if (framing) {
+                    readFrame(from_server, frame_from_server);
+                } else {
+                    from_server >> msg_from_server;
+                }
+            } catch (incomplete_message &) {
+                from_server.rewind(message_start);
+                break;
+            }
+            if (framing) {
+                if (!readFromFrame(frame_from_server, FramingEnabled, [this](MemoryBuffer &from) {
+                        read_server_message(from, msg_from_server, msg_to_gui, applier);
+                    })) {
+                    continue;
+                }
+            } else if (msg_from_server.msg_type != FramingEnabled) {
+                message_to_gui_from_server_msg(msg_from_server, msg_to_gui, applier);
+            }
+            if (msg_from_server.msg_type == FramingEnabled) {
+                framing = true;
+                continue;
+            }
+
+            if (msg_from_server.msg_type != GameStarted) {
+                to_gui.changed();
+            }
+        }
+    }
+
+    // Sends the newest state to gui, called when no whole message from the
+    // server waits. State that waits for the rate limit is sent by the timer,
+    // unless the server sends something before, which is handled first.
+    void update_gui() {
+        if (!to_gui.flush(msg_to_gui) || gui_timer_waiting) return;
+        gui_timer_waiting = true;
+        gui_timer.expires_at(to_gui.deadline());
+        gui_timer.async_wait([this](const boost::system::error_code &) {
+            gui_timer_waiting = false;
+            boost::system::error_code error;
+            if (client_info.server_socket.available(error) > 0) return;
+            try {
+                update_gui();
+            } catch (std::exception &e) {
+                fail(e.what());
+            }
+        });
+    }
+
+   public:
+    explicit EventLoopClient(ClientInfo &info)
+        : client_info(info),
+          from_gui(info.gui_socket, info.gui_endpoint),
+          to_gui(info),
+          gui_timer(info.io_context) {
+        to_gui.prepare(msg_to_gui);
+    }
+
+    // Starts serving both sockets, io_context has to be run afterwards.
+    void start() {
+        if (client_info.settings.framing) {
+            ClientMessage enable_framing;
+            enable_framing.msg_type = EnableFraming;
+            send_to_server(enable_framing);
+        }
+        receive_from_gui();
+        receive_from_server();
+    }
+};
+
 int main(int argc, char *argv[]) {
     try {
         client_parameters settings = check_parameters_and_fill_settings(argc, argv);
         ClientInfo client_info(settings);
 
+        if (settings.event_loop) {
+            EventLoopClient client(client_info);
+            client.start();
+            client_info.io_context.run();
+            return 0;
+        }
+
         std::thread gui_listener_thread(receive_from_gui_send_to_server, std::ref(client_info));
         std::thread server_listener_thread(receive_from_server_send_to_gui, std::ref(client_info));
 
@@ -1,12 +1,16 @@
 // The server is not finished, but it at least tries to do something useful..
 
+// Boost 1.74 asio uses std::exchange without including <utility> itself.
+#include <utility>
+
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 
 #include "definitions.hpp"
-#include "game.hpp"
+#include "server.hpp"
 
 namespace po = boost::program_options;
 using boost::asio::ip::tcp;
@@ -19,6 +23,7 @@ server_parameters check_parameters_and_fill_settings(int argc, char* argv[]) {
     server_parameters launch_settings;
 
     uint16_t players_count_u16;
+    std::string backend;
     try {
         po::options_description description("Allowed options");
 
@@ -42,19 +47,46 @@ server_parameters check_parameters_and_fill_settings(int argc, char* argv[]) {
             "size-x,x", po::value<uint16_t>(&launch_settings.size_x)->required(),
             "set size-x - horizontal dimension of board")(
             "size-y,y", po::value<uint16_t>(&launch_settings.size_y)->required(),
-            "set size-y - vertical dimension of board");
+            "set size-y - vertical dimension of board")(
+            "threads,t",
+            po::value<uint16_t>(&launch_settings.threads)
+                ->default_value((uint16_t)std::max(1u, std::thread::hardware_concurrency())),
+            "set number of threads running games")(
+            "spectator-port,S", po::value<uint16_t>(&launch_settings.spectator_port),
+            "set UDP port for spectators, spectators are not served if it is not set")(
+            "backend,B", po::value<std::string>(&backend)->default_value("asio"),
+            "set implementation of sockets: asio or uring")(
+            "output-limit,q",
+            po::value<uint32_t>(&launch_settings.output_limit)
+                ->default_value((uint32_t)SESSION_OUTPUT_LIMIT),
+            "set limit of bytes queued for a client, slower clients are disconnected");
 
         po::variables_map vm;
         po::store(po::parse_command_line(argc, argv, description), vm);
 
         if (vm.count("help")) {
-            std::cout << "Usage: ./robots-client [options]\n";
+            std::cout << "Usage: ./robots-server [options]\n";
             std::cout << description;
             exit(EXIT_SUCCESS);
         }
 
         po::notify(vm);
+        if (players_count_u16 == 0 || players_count_u16 > UINT8_MAX) {
+            throw std::invalid_argument("players-count has to be between 1 and 255");
+        }
+        if (launch_settings.size_x == 0 || launch_settings.size_y == 0) {
+            throw std::invalid_argument("size-x and size-y have to be positive");
+        }
         launch_settings.players_count = (uint8_t)players_count_u16;
+        if (backend == "uring") {
+            launch_settings.backend = UringBackend;
+        } else if (backend != "asio") {
+            throw std::invalid_argument("backend has to be asio or uring");
+        }
+        if (!vm.count("seed")) {
+            launch_settings.seed =
+                (uint32_t)std::chrono::system_clock::now().time_since_epoch().count();
+        }
     } catch (std::exception& e) {
         std::cerr << "error: " << e.what() << "\n";
         exit(EXIT_FAILURE);
@@ -68,7 +100,13 @@ server_parameters check_parameters_and_fill_settings(int argc, char* argv[]) {
 
 int main(int argc, char* argv[]) {
     server_parameters launch_settings = check_parameters_and_fill_settings(argc, argv);
-    class Game game(launch_settings);
-    game.run_game();
+    std::cout << "Seed of the first game: " << launch_settings.seed << '\n';
+    try {
+        Server server(launch_settings);
+        server.run();
+    } catch (std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
     return 0;
 }
\ No newline at end of file
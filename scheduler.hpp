@@ -0,0 +1,109 @@
+/* Pacing of game turns. Deadlines are computed from the moment the game
+ * started (start + k * turn_duration), so time spent on simulating and
+ * sending a turn is not added to the turn length and turns do not drift. */
+
+#ifndef BOMBERMAN_SCHEDULER_HPP
+#define BOMBERMAN_SCHEDULER_HPP
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Collects durations of one kind and summarizes their distribution.
+class DurationStatistics {
+    std::string name;
+    std::vector<int64_t> samples;
+
+    [[nodiscard]] static double to_micros(int64_t nanos) { return (double)nanos / 1000.0; }
+
+   public:
+    explicit DurationStatistics(std::string n) : name(std::move(n)) {}
+
+    // Removes all samples and makes space for expected number of them,
+    // so recording during the game does not allocate.
+    void reset(size_t expected_samples) {
+        samples.clear();
+        samples.reserve(expected_samples);
+    }
+
+    void record(std::chrono::nanoseconds duration) { samples.push_back(duration.count()); }
+
+    // Prints count, mean, percentiles and maximum in microseconds.
+    void print(std::ostream &out) const {
+        out << name << ": ";
+        if (samples.empty()) {
+            out << "no samples\n";
+            return;
+        }
+        std::vector<int64_t> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        int64_t sum = 0;
+        for (auto sample : sorted) {
+            sum += sample;
+        }
+        auto percentile = [&sorted](size_t p) { return sorted[(sorted.size() - 1) * p / 100]; };
+        out << "count " << sorted.size() << ", mean "
+            << to_micros(sum / (int64_t)sorted.size()) << "us, p50 "
+            << to_micros(percentile(50)) << "us, p90 " << to_micros(percentile(90))
+            << "us, p99 " << to_micros(percentile(99)) << "us, max "
+            << to_micros(sorted.back()) << "us\n";
+    }
+};
+
+// Runs turn handlers at absolute deadlines on a steady_timer.
+// If a turn is late, the next deadline stays where it was, so the
+// scheduler catches up by running late turns right away, without
+// skipping any of them.
+class TurnScheduler {
+    using clock = std::chrono::steady_clock;
+
+    boost::asio::steady_timer timer;
+    clock::duration turn_duration;
+    clock::time_point start_time;
+    uint64_t turns = 0;
+
+    // How long after its deadline each turn started.
+    DurationStatistics lateness{"Turn lateness"};
+    // How long each turn handler was running.
+    DurationStatistics processing{"Turn processing"};
+
+   public:
+    TurnScheduler(boost::asio::io_context &io_context, std::chrono::milliseconds duration)
+        : timer(io_context), turn_duration(duration) {}
+
+    // Starts counting deadlines from now.
+    void start(size_t expected_turns) {
+        start_time = clock::now();
+        turns = 0;
+        lateness.reset(expected_turns);
+        processing.reset(expected_turns);
+    }
+
+    // Calls handler at the deadline of the next turn.
+    template <typename Handler>
+    void schedule_next(Handler handler) {
+        turns++;
+        clock::time_point deadline = start_time + turn_duration * turns;
+        timer.expires_at(deadline);
+        timer.async_wait([this, deadline, handler](const boost::system::error_code &error) {
+            if (error) return;
+            clock::time_point begin = clock::now();
+            lateness.record(begin - deadline);
+            handler();
+            processing.record(clock::now() - begin);
+        });
+    }
+
+    void cancel() { timer.cancel(); }
+
+    void print_statistics(std::ostream &out) const {
+        lateness.print(out);
+        processing.print(out);
+    }
+};
+
+#endif  // BOMBERMAN_SCHEDULER_HPP
@@ -1,10 +1,15 @@
 #ifndef BOMBERMAN_SERIALIZATION_HPP
 #define BOMBERMAN_SERIALIZATION_HPP
+#include <array>
+#include <concepts>
 #include <map>
 #include <set>
+#include <span>
 #include <string>
+#include <type_traits>
 #include <utility>
 
+#include "board.hpp"
 #include "buffer.hpp"
 #include "definitions.hpp"
 
@@ -13,96 +18,187 @@
  *                                                   */
 
 // Writing uint8_t operator.
-Buffer &operator<<(Buffer &buffer, const uint8_t &val) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const uint8_t &val) {
     buffer.writeUint8(val);
     return buffer;
 }
 
 // Reading uint8_t operator.
-Buffer &operator>>(Buffer &buffer, uint8_t &val) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, uint8_t &val) {
     val = buffer.readUint8();
     return buffer;
 }
 
 // Writing uint16_t operator.
-Buffer &operator<<(Buffer &buffer, const uint16_t &val) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const uint16_t &val) {
     buffer.writeUint16(val);
     return buffer;
 }
 
 // Reading uint16_t operator.
-Buffer &operator>>(Buffer &buffer, uint16_t &val) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, uint16_t &val) {
     val = buffer.readUint16();
     return buffer;
 }
 
 // Writing uint32_t operator.
-Buffer &operator<<(Buffer &buffer, const uint32_t &val) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const uint32_t &val) {
     buffer.writeUint32(val);
     return buffer;
 }
 
 // Reading uint32_t operator.
-Buffer &operator>>(Buffer &buffer, uint32_t &val) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, uint32_t &val) {
     val = buffer.readUint32();
     return buffer;
 }
 
 // Writing string operator.
-Buffer &operator<<(Buffer &buffer, const std::string &str) {
-    buffer.writeUint8((uint8_t)str.size());
-    buffer.writeString(str);
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const std::string &str) {
+    buffer.ensureWrite(sizeof(uint8_t) + str.size());
+    buffer.putUint8((uint8_t)str.size());
+    buffer.putString(str);
     return buffer;
 }
 
 // Reading string operator.
-Buffer &operator>>(Buffer &buffer, std::string &str) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, std::string &str) {
     str = buffer.readString(buffer.readUint8());
     return buffer;
 }
 
+/* Unchecked writing and reading of fixed size structs and containers of them. */
+
+// Number of bytes taken by encoded position.
+static const size_t POSITION_SIZE = 2 * sizeof(uint16_t);
+// Number of bytes taken by encoded bomb.
+static const size_t BOMB_SIZE = POSITION_SIZE + sizeof(uint16_t);
+
+template <typename T>
+void putPosition(Buffer<T> &buffer, const Position &position) {
+    buffer.putUint16(position.x);
+    buffer.putUint16(position.y);
+}
+
+template <typename T>
+Position getPosition(Buffer<T> &buffer) {
+    Position position;
+    position.x = buffer.getUint16();
+    position.y = buffer.getUint16();
+    return position;
+}
+
+// Arrays of positions are copied as arrays of their uint16 coordinates.
+static_assert(sizeof(Position) == POSITION_SIZE && std::is_trivially_copyable_v<Position>);
+
+// Number of positions gathered from a board before they are written at once.
+static const size_t POSITION_CHUNK = 256;
+
+// Writes positions without their count, converting all their coordinates at once.
+template <typename T>
+void writePositionArray(Buffer<T> &buffer, const Position *positions, size_t count) {
+    while (count > 0) {
+        size_t batch = buffer.ensureWriteElements(count, POSITION_SIZE);
+        buffer.putUint16s(positions, batch * 2);
+        positions += batch;
+        count -= batch;
+    }
+}
+
+// Writes size of container and its elements, each taking element_size bytes.
+// Capacity is checked once per batch of elements instead of once per field,
+// for buffers that grow the whole container is a single batch.
+template <typename T, typename Container, typename Put>
+void writeElements(Buffer<T> &buffer, const Container &elements, size_t element_size, Put put) {
+    buffer.writeUint32((uint32_t)elements.size());
+    auto it = elements.begin();
+    size_t remaining = elements.size();
+    while (remaining > 0) {
+        size_t batch = buffer.ensureWriteElements(remaining, element_size);
+        for (size_t i = 0; i < batch; i++, ++it) {
+            put(*it);
+        }
+        remaining -= batch;
+    }
+}
+
+// Reads size of container and calls get for each of its elements,
+// which take element_size bytes. Capacity is checked once per batch.
+template <typename T, typename Get>
+void readElements(Buffer<T> &buffer, size_t element_size, Get get) {
+    size_t remaining = buffer.readUint32();
+    while (remaining > 0) {
+        size_t batch = buffer.ensureReadElements(remaining, element_size);
+        for (size_t i = 0; i < batch; i++) {
+            get();
+        }
+        remaining -= batch;
+    }
+}
+
 /*                                                    *
  * Operators for reading and writing defined structs and classes. *
  *                                                    */
 
 // Writing struct player operator.
-Buffer &operator<<(Buffer &buffer, const Player &player) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Player &player) {
     buffer << player.player_name << player.player_address;
     return buffer;
 }
 
 // Reading struct player operator.
-Buffer &operator>>(Buffer &buffer, Player &player) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, Player &player) {
     buffer >> player.player_name >> player.player_address;
     return buffer;
 }
 
 // Writing struct position operator.
-Buffer &operator<<(Buffer &buffer, const Position &position) {
-    buffer << position.x << position.y;
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Position &position) {
+    buffer.ensureWrite(POSITION_SIZE);
+    putPosition(buffer, position);
     return buffer;
 }
 
 // Reading struct position operator.
-Buffer &operator>>(Buffer &buffer, Position &position) {
-    buffer >> position.x >> position.y;
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, Position &position) {
+    buffer.ensureRead(POSITION_SIZE);
+    position = getPosition(buffer);
     return buffer;
 }
 
 // Writing struct bomb operator.
-Buffer &operator<<(Buffer &buffer, const Bomb &bomb) {
-    buffer << bomb.position << bomb.timer;
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Bomb &bomb) {
+    buffer.ensureWrite(BOMB_SIZE);
+    putPosition(buffer, bomb.position);
+    buffer.putUint16(bomb.timer);
     return buffer;
 }
 
 // Reading struct bomb operator.
-Buffer &operator>>(Buffer &buffer, Bomb &bomb) {
-    buffer >> bomb.position >> bomb.timer;
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, Bomb &bomb) {
+    buffer.ensureRead(BOMB_SIZE);
+    bomb.position = getPosition(buffer);
+    bomb.timer = buffer.getUint16();
     return buffer;
 }
 
 // Direction read operator.
-Buffer &operator>>(Buffer &buffer, Direction &direction) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, Direction &direction) {
     uint8_t dir;
     buffer >> dir;
     if (dir > 3) {
@@ -113,7 +209,8 @@ Buffer &operator>>(Buffer &buffer, Direction &direction) {
 }
 
 // Direction write operator.
-Buffer &operator<<(Buffer &buffer, const Direction &direction) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Direction &direction) {
     buffer << (uint8_t)direction;
     return buffer;
 }
@@ -122,8 +219,14 @@ Buffer &operator<<(Buffer &buffer, const Direction &direction) {
  * Operators for reading and writing maps sets and vectors of defined objects.  *
  *                                                                              */
 
+// Maps and tables of values indexed by player id, which are encoded the same way.
+template <typename Container, typename Value>
+concept PlayerIndexed = std::same_as<typename Container::key_type, player_id_t> &&
+                        std::same_as<typename Container::mapped_type, Value>;
+
 // Writing players map operator.
-Buffer &operator<<(Buffer &buffer, const std::map<player_id_t, Player> &players) {
+template <typename T, PlayerIndexed<Player> Players>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Players &players) {
     buffer << (uint32_t)players.size();
     for (const auto &elem : players) {
         buffer << elem.first << elem.second;
@@ -132,7 +235,8 @@ Buffer &operator<<(Buffer &buffer, const std::map<player_id_t, Player> &players)
 }
 
 // Reading players map operator.
-Buffer &operator>>(Buffer &buffer, std::map<player_id_t, Player> &players) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, std::map<player_id_t, Player> &players) {
     size_t size = buffer.readUint32();
     players.clear();
     for (size_t i = 0; i < size; i++) {
@@ -144,93 +248,158 @@ Buffer &operator>>(Buffer &buffer, std::map<player_id_t, Player> &players) {
     return buffer;
 }
 
-// Writing bombs map operator.
-Buffer &operator<<(Buffer &buffer, const std::map<bomb_id_t, Bomb> &bombs) {
-    buffer << (uint32_t)bombs.size();
-    for (const auto &elem : bombs) {
+// Writing bombs table operator.
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const BombTable<Bomb> &bombs) {
+    writeElements(buffer, bombs, BOMB_SIZE, [&buffer](const auto &slot) {
         // We don't want to send bomb id.
-        buffer << elem.second;
-    }
+        putPosition(buffer, slot.value.position);
+        buffer.putUint16(slot.value.timer);
+    });
     return buffer;
 }
 
 // Writing positions map operator.
-Buffer &operator<<(Buffer &buffer, const std::map<player_id_t, Position> &positions) {
-    buffer << (uint32_t)positions.size();
-    for (const auto &elem : positions) {
-        buffer << elem.first << elem.second;
-    }
+template <typename T, PlayerIndexed<Position> Positions>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Positions &positions) {
+    writeElements(buffer, positions, sizeof(player_id_t) + POSITION_SIZE,
+                  [&buffer](const auto &elem) {
+                      buffer.putUint8(elem.first);
+                      putPosition(buffer, elem.second);
+                  });
     return buffer;
 }
 
 // Writing scores map operator.
-Buffer &operator<<(Buffer &buffer, const std::map<player_id_t, score_t> &scores) {
-    buffer << (uint32_t)scores.size();
-    for (const auto &elem : scores) {
-        buffer << elem.first << elem.second;
-    }
+template <typename T, PlayerIndexed<score_t> Scores>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Scores &scores) {
+    writeElements(buffer, scores, sizeof(player_id_t) + sizeof(score_t),
+                  [&buffer](const auto &elem) {
+                      buffer.putUint8(elem.first);
+                      buffer.putUint32(elem.second);
+                  });
     return buffer;
 }
 
 // Reading scores map operator;
-Buffer &operator>>(Buffer &buffer, std::map<player_id_t, score_t> &scores) {
-    size_t size = buffer.readUint32();
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, std::map<player_id_t, score_t> &scores) {
     scores.clear();
-    for (size_t i = 0; i < size; i++) {
-        player_id_t id;
-        score_t score;
-        buffer >> id >> score;
-        scores.insert({id, score});
+    readElements(buffer, sizeof(player_id_t) + sizeof(score_t), [&buffer, &scores]() {
+        player_id_t id = buffer.getUint8();
+        scores.insert({id, buffer.getUint32()});
+    });
+    return buffer;
+}
+
+// Writing board cells operator. Cells are gathered in chunks,
+// so that their coordinates can be converted in bulk.
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Board &board) {
+    buffer.writeUint32((uint32_t)board.size());
+    std::array<Position, POSITION_CHUNK> chunk;
+    size_t gathered = 0;
+    board.for_each([&](Position position) {
+        chunk[gathered++] = position;
+        if (gathered == chunk.size()) {
+            writePositionArray(buffer, chunk.data(), gathered);
+            gathered = 0;
+        }
+    });
+    writePositionArray(buffer, chunk.data(), gathered);
+    return buffer;
+}
+
+// Reading positions vector operator.
+template <typename T, typename Allocator>
+Buffer<T> &operator>>(Buffer<T> &buffer, std::vector<Position, Allocator> &positions) {
+    positions.clear();
+    size_t remaining = buffer.readUint32();
+    while (remaining > 0) {
+        size_t batch = buffer.ensureReadElements(remaining, POSITION_SIZE);
+        size_t read = positions.size();
+        positions.resize(read + batch);
+        buffer.getUint16s(positions.data() + read, batch * 2);
+        remaining -= batch;
     }
     return buffer;
 }
 
-// Writing positions set operator.
-Buffer &operator<<(Buffer &buffer, const std::set<Position> &positions) {
-    buffer << (uint32_t)positions.size();
-    for (const auto &elem : positions) {
-        buffer << elem;
-    }
+// Writing positions vector operator.
+template <typename T, typename Allocator>
+Buffer<T> &operator<<(Buffer<T> &buffer, const std::vector<Position, Allocator> &positions) {
+    buffer.writeUint32((uint32_t)positions.size());
+    writePositionArray(buffer, positions.data(), positions.size());
     return buffer;
 }
 
-// Reading positions set operator.
-Buffer &operator>>(Buffer &buffer, std::set<Position> &positions) {
-    size_t size = buffer.readUint32();
-    positions.clear();
-    for (size_t i = 0; i < size; i++) {
-        Position p;
-        buffer >> p;
-        positions.insert(p);
+// Reading player id's vector operator.
+template <typename T, typename Allocator>
+Buffer<T> &operator>>(Buffer<T> &buffer, std::vector<player_id_t, Allocator> &players) {
+    players.clear();
+    size_t remaining = buffer.readUint32();
+    while (remaining > 0) {
+        size_t batch = buffer.ensureReadElements(remaining, sizeof(player_id_t));
+        size_t read = players.size();
+        players.resize(read + batch);
+        buffer.getBytes((char *)players.data() + read, batch);
+        remaining -= batch;
     }
     return buffer;
 }
 
-// Reading player id's set operator.
-Buffer &operator>>(Buffer &buffer, std::set<player_id_t> &players) {
-    size_t size = buffer.readUint32();
-    players.clear();
-    for (size_t i = 0; i < size; i++) {
-        player_id_t id;
-        buffer >> id;
-        players.insert(id);
+// Writing player id's vector operator.
+template <typename T, typename Allocator>
+Buffer<T> &operator<<(Buffer<T> &buffer, const std::vector<player_id_t, Allocator> &players) {
+    buffer.writeUint32((uint32_t)players.size());
+    size_t written = 0;
+    while (written < players.size()) {
+        size_t batch = buffer.ensureWriteElements(players.size() - written, sizeof(player_id_t));
+        buffer.putBytes((const char *)players.data() + written, batch);
+        written += batch;
     }
     return buffer;
 }
 
-// Writing player id's set operator.
-Buffer &operator<<(Buffer &buffer, const std::set<player_id_t> &players) {
-    buffer << (uint32_t)(players.size());
-    for (auto id : players) {
-        buffer << id;
-    }
+// Writing bombs vector operator.
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const std::vector<Bomb> &bombs) {
+    writeElements(buffer, bombs, BOMB_SIZE, [&buffer](const Bomb &bomb) {
+        putPosition(buffer, bomb.position);
+        buffer.putUint16(bomb.timer);
+    });
+    return buffer;
+}
+
+// Writing changes of game state operator.
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const GuiDelta &delta) {
+    buffer << delta.base_turn << delta.blocks_placed << delta.blocks_destroyed
+           << delta.player_positions << delta.bombs_placed << delta.bombs_exploded
+           << delta.scores;
     return buffer;
 }
 
 /* Reading events operators. */
 
+// Writing game snapshot operator.
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const GameSnapshot &snapshot) {
+    buffer << (uint8_t)Snapshot << snapshot.turn << snapshot.players
+           << snapshot.player_positions << snapshot.blocks;
+    writeElements(buffer, snapshot.bombs, sizeof(bomb_id_t) + BOMB_SIZE,
+                  [&buffer](const auto &bomb) {
+                      buffer.putUint32(bomb.first);
+                      putPosition(buffer, bomb.second.position);
+                      buffer.putUint16(bomb.second.timer);
+                  });
+    buffer << snapshot.scores;
+    return buffer;
+}
+
 // Reading event operator.
-Buffer &operator>>(Buffer &buffer, Event &event) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, Event &event) {
     uint8_t event_type;
     buffer >> event_type;
     if (event_type > 3) {
@@ -239,13 +408,17 @@ Buffer &operator>>(Buffer &buffer, Event &event) {
     event.event_type = (EventType)event_type;
     switch (event.event_type) {
         case BombPlaced:
-            buffer >> event.bomb_id >> event.position;
+            buffer.ensureRead(sizeof(bomb_id_t) + POSITION_SIZE);
+            event.bomb_id = buffer.getUint32();
+            event.position = getPosition(buffer);
             break;
         case BombExploded:
             buffer >> event.bomb_id >> event.robots_destroyed >> event.blocks_destroyed;
             break;
         case PlayerMoved:
-            buffer >> event.player_id >> event.position;
+            buffer.ensureRead(sizeof(player_id_t) + POSITION_SIZE);
+            event.player_id = buffer.getUint8();
+            event.position = getPosition(buffer);
             break;
         case BlockPlaced:
             buffer >> event.position;
@@ -255,39 +428,68 @@ Buffer &operator>>(Buffer &buffer, Event &event) {
 }
 
 // Writing event operator.
-Buffer &operator<<(Buffer &buffer, const Event &event) {
-    buffer << (uint8_t)event.event_type;
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const Event &event) {
+    // Fixed size part of every event is written after a single check.
     switch (event.event_type) {
         case BombPlaced:
-            buffer << event.bomb_id << event.position;
+            buffer.ensureWrite(sizeof(uint8_t) + sizeof(bomb_id_t) + POSITION_SIZE);
+            buffer.putUint8(BombPlaced);
+            buffer.putUint32(event.bomb_id);
+            putPosition(buffer, event.position);
             break;
         case BombExploded:
-            buffer << event.bomb_id << event.robots_destroyed << event.blocks_destroyed;
+            buffer.ensureWrite(sizeof(uint8_t) + sizeof(bomb_id_t));
+            buffer.putUint8(BombExploded);
+            buffer.putUint32(event.bomb_id);
+            buffer << event.robots_destroyed << event.blocks_destroyed;
             break;
         case PlayerMoved:
-            buffer << event.player_id << event.position;
+            buffer.ensureWrite(sizeof(uint8_t) + sizeof(player_id_t) + POSITION_SIZE);
+            buffer.putUint8(PlayerMoved);
+            buffer.putUint8(event.player_id);
+            putPosition(buffer, event.position);
             break;
         case BlockPlaced:
-            buffer << event.position;
+            buffer.ensureWrite(sizeof(uint8_t) + POSITION_SIZE);
+            buffer.putUint8(BlockPlaced);
+            putPosition(buffer, event.position);
             break;
     }
     return buffer;
 }
 
-// Read events vector operator.
-Buffer &operator>>(Buffer &buffer, std::vector<Event> &events) {
+// Number of events space is reserved for before they are read. Count of events
+// comes from the network, so larger turns still grow the vector while read.
+static const size_t EVENTS_RESERVED = 1024;
+
+// Read events vector operator. Events are decoded in place, so their vectors
+// are allocated once, from the resource of the events vector.
+template <typename T, typename Allocator>
+Buffer<T> &operator>>(Buffer<T> &buffer, std::vector<Event, Allocator> &events) {
     size_t size = buffer.readUint32();
     events.clear();
+    events.reserve(std::min(size, EVENTS_RESERVED));
     for (size_t i = 0; i < size; i++) {
-        Event event;
-        buffer >> event;
-        events.push_back(event);
+        buffer >> events.emplace_back();
     }
     return buffer;
 }
 
-// Write events vector operator.
-Buffer &operator<<(Buffer &buffer, const std::vector<Event> &events) {
+// Reads events one at a time into the same event, passing each of them
+// to handle right after it is read, so events are never kept together.
+template <typename T, typename Handler>
+void readEvents(Buffer<T> &buffer, Event &event, Handler &&handle) {
+    size_t size = buffer.readUint32();
+    for (size_t i = 0; i < size; i++) {
+        buffer >> event;
+        handle(event);
+    }
+}
+
+// Write events span operator.
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, std::span<const Event> events) {
     buffer << (uint32_t)events.size();
     for (const auto &event : events) {
         buffer << event;
@@ -298,7 +500,8 @@ Buffer &operator<<(Buffer &buffer, const std::vector<Event> &events) {
 /* Reading and writing actual messages that client and server will receive or send. */
 
 // Writing message to gui operator.
-Buffer &operator<<(Buffer &buffer, const MessageToGui &message) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const MessageToGui &message) {
     buffer << (uint8_t)message.msg_type;
     switch (message.msg_type) {
         case Lobby:
@@ -311,14 +514,18 @@ Buffer &operator<<(Buffer &buffer, const MessageToGui &message) {
                    << message.turn << message.players << message.player_positions << message.blocks
                    << message.bombs << message.explosions << message.scores;
             break;
+        case GameDelta:
+            buffer << message.turn << *message.delta << message.explosions;
+            break;
     }
     return buffer;
 }
 
 // Read message from gui operator.
-Buffer &operator>>(Buffer &buffer, GuiInputMessage &message) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, GuiInputMessage &message) {
     uint8_t msg_type = buffer.readUint8();
-    if (msg_type > 2) {
+    if (msg_type > RequestKeyframeGui) {
         throw std::invalid_argument("Wrong message type received");
     }
     message.msg_type = (GuiInputEnum)msg_type;
@@ -330,7 +537,8 @@ Buffer &operator>>(Buffer &buffer, GuiInputMessage &message) {
 }
 
 // Write client message operator.
-Buffer &operator<<(Buffer &buffer, const ClientMessage &message) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const ClientMessage &message) {
     buffer << (uint8_t)(message.msg_type);
     if (message.msg_type == Join) {
         buffer << message.player_name;
@@ -341,9 +549,10 @@ Buffer &operator<<(Buffer &buffer, const ClientMessage &message) {
 }
 
 // Read client message operator.
-Buffer &operator>>(Buffer &buffer, ClientMessage &message) {
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, ClientMessage &message) {
     uint8_t msg_type = buffer.readUint8();
-    if (msg_type > 3) {
+    if (msg_type > EnableFraming) {
         throw std::invalid_argument("Wrong message type received");
     }
     message.msg_type = (ClientMessageEnum)msg_type;
@@ -355,13 +564,19 @@ Buffer &operator>>(Buffer &buffer, ClientMessage &message) {
     return buffer;
 }
 
-// Reading server message operator.
-Buffer &operator>>(Buffer &buffer, ServerMessage &message) {
+// Reads type of server message, which decides what follows it.
+template <typename T>
+ServerMessageEnum readServerMessageType(Buffer<T> &buffer) {
     uint8_t msg_type = buffer.readUint8();
-    if (msg_type > 4) {
+    if (msg_type > FramingEnabled) {
         throw std::invalid_argument("Wrong message type received");
     }
-    message.msg_type = (ServerMessageEnum)msg_type;
+    return (ServerMessageEnum)msg_type;
+}
+
+// Reads contents of server message of type set in the message.
+template <typename T>
+void readServerMessageBody(Buffer<T> &buffer, ServerMessage &message) {
     switch (message.msg_type) {
         case Hello:
             buffer >> message.server_name >> message.player_count >> message.size_x >>
@@ -380,12 +595,22 @@ Buffer &operator>>(Buffer &buffer, ServerMessage &message) {
         case GameEnded:
             buffer >> message.scores;
             break;
+        case FramingEnabled:
+            break;
     }
+}
+
+// Reading server message operator.
+template <typename T>
+Buffer<T> &operator>>(Buffer<T> &buffer, ServerMessage &message) {
+    message.msg_type = readServerMessageType(buffer);
+    readServerMessageBody(buffer, message);
     return buffer;
 }
 
 // Writing server message operator.
-Buffer &operator<<(Buffer &buffer, const ServerMessage &message) {
+template <typename T>
+Buffer<T> &operator<<(Buffer<T> &buffer, const ServerMessage &message) {
     buffer << (uint8_t)message.msg_type;
     switch (message.msg_type) {
         case Hello:
@@ -405,8 +630,309 @@ Buffer &operator<<(Buffer &buffer, const ServerMessage &message) {
         case GameEnded:
             buffer << message.scores;
             break;
+        case FramingEnabled:
+            break;
     }
     return buffer;
 }
 
+/* Sizes of encoded messages, known before writing them. Messages and events
+ * with fixed layout have constexpr sizes, sizes of the others are computed
+ * with a single pass over their containers. */
+
+// Number of bytes taken by encoded event of fixed layout, that is every
+// event except BombExploded, whose size depends on what it destroyed.
+constexpr size_t fixedEventSize(EventType type) {
+    switch (type) {
+        case BombPlaced:
+            return sizeof(uint8_t) + sizeof(bomb_id_t) + POSITION_SIZE;
+        case BombExploded:
+            return sizeof(uint8_t) + sizeof(bomb_id_t) + 2 * sizeof(uint32_t);
+        case PlayerMoved:
+            return sizeof(uint8_t) + sizeof(player_id_t) + POSITION_SIZE;
+        case BlockPlaced:
+            return sizeof(uint8_t) + POSITION_SIZE;
+    }
+    return 0;
+}
+
+// Number of bytes taken by encoded client message of fixed layout,
+// that is every message except Join, which carries player name.
+constexpr size_t fixedClientMessageSize(ClientMessageEnum type) {
+    return type == Move ? sizeof(uint8_t) + sizeof(uint8_t) : sizeof(uint8_t);
+}
+
+// Number of bytes taken by Hello message without server name. Lobby
+// message to the GUI starts with the same fields.
+static constexpr size_t HELLO_FIXED_SIZE = 2 * sizeof(uint8_t) + 5 * sizeof(uint16_t);
+// Number of bytes taken by type and number of Turn message.
+static constexpr size_t TURN_HEADER_SIZE = sizeof(uint8_t) + sizeof(uint16_t);
+
+constexpr size_t encodedSize(const uint8_t &) { return sizeof(uint8_t); }
+
+constexpr size_t encodedSize(const uint16_t &) { return sizeof(uint16_t); }
+
+constexpr size_t encodedSize(const uint32_t &) { return sizeof(uint32_t); }
+
+inline size_t encodedSize(const std::string &str) { return sizeof(uint8_t) + str.size(); }
+
+inline size_t encodedSize(const Player &player) {
+    return encodedSize(player.player_name) + encodedSize(player.player_address);
+}
+
+template <PlayerIndexed<Player> Players>
+size_t encodedSize(const Players &players) {
+    size_t size = sizeof(uint32_t) + players.size() * sizeof(player_id_t);
+    for (const auto &elem : players) {
+        size += encodedSize(elem.second);
+    }
+    return size;
+}
+
+inline size_t encodedSize(const Event &event) {
+    if (event.event_type != BombExploded) return fixedEventSize(event.event_type);
+    return fixedEventSize(BombExploded) + event.robots_destroyed.size() * sizeof(player_id_t) +
+           event.blocks_destroyed.size() * POSITION_SIZE;
+}
+
+inline size_t encodedSize(std::span<const Event> events) {
+    size_t size = sizeof(uint32_t);
+    for (const auto &event : events) {
+        size += encodedSize(event);
+    }
+    return size;
+}
+
+template <typename Allocator>
+size_t encodedSize(const std::vector<Event, Allocator> &events) {
+    return encodedSize(std::span<const Event>(events));
+}
+
+inline size_t encodedSize(const ClientMessage &message) {
+    if (message.msg_type == Join) return sizeof(uint8_t) + encodedSize(message.player_name);
+    return fixedClientMessageSize(message.msg_type);
+}
+
+inline size_t encodedSize(const ServerMessage &message) {
+    switch (message.msg_type) {
+        case Hello:
+            return HELLO_FIXED_SIZE + encodedSize(message.server_name);
+        case AcceptedPlayer:
+            return sizeof(uint8_t) + sizeof(player_id_t) + encodedSize(message.player);
+        case GameStarted:
+            return sizeof(uint8_t) + encodedSize(message.players);
+        case Turn:
+            return TURN_HEADER_SIZE + encodedSize(message.events);
+        case GameEnded:
+            return sizeof(uint8_t) + sizeof(uint32_t) +
+                   message.scores.size() * (sizeof(player_id_t) + sizeof(score_t));
+        case FramingEnabled:
+            return sizeof(uint8_t);
+    }
+    return sizeof(uint8_t);
+}
+
+inline size_t encodedSize(const GameSnapshot &snapshot) {
+    return sizeof(uint8_t) + sizeof(uint16_t) + encodedSize(snapshot.players) + sizeof(uint32_t) +
+           snapshot.player_positions.size() * (sizeof(player_id_t) + POSITION_SIZE) +
+           sizeof(uint32_t) + snapshot.blocks.size() * POSITION_SIZE + sizeof(uint32_t) +
+           snapshot.bombs.size() * (sizeof(bomb_id_t) + BOMB_SIZE) + sizeof(uint32_t) +
+           snapshot.scores.size() * (sizeof(player_id_t) + sizeof(score_t));
+}
+
+inline size_t encodedSize(const GuiDelta &delta) {
+    return sizeof(uint16_t) + sizeof(uint32_t) + delta.blocks_placed.size() * POSITION_SIZE +
+           sizeof(uint32_t) + delta.blocks_destroyed.size() * POSITION_SIZE + sizeof(uint32_t) +
+           delta.player_positions.size() * (sizeof(player_id_t) + POSITION_SIZE) +
+           sizeof(uint32_t) + delta.bombs_placed.size() * BOMB_SIZE + sizeof(uint32_t) +
+           delta.bombs_exploded.size() * BOMB_SIZE + sizeof(uint32_t) +
+           delta.scores.size() * (sizeof(player_id_t) + sizeof(score_t));
+}
+
+inline size_t encodedSize(const MessageToGui &message) {
+    switch (message.msg_type) {
+        case Lobby:
+            return HELLO_FIXED_SIZE + encodedSize(message.server_name) +
+                   encodedSize(message.players);
+        case Game:
+            return sizeof(uint8_t) + encodedSize(message.server_name) + 4 * sizeof(uint16_t) +
+                   encodedSize(message.players) + sizeof(uint32_t) +
+                   message.player_positions.size() * (sizeof(player_id_t) + POSITION_SIZE) +
+                   sizeof(uint32_t) + message.blocks.size() * POSITION_SIZE + sizeof(uint32_t) +
+                   message.bombs.size() * BOMB_SIZE + sizeof(uint32_t) +
+                   message.explosions.size() * POSITION_SIZE + sizeof(uint32_t) +
+                   message.scores.size() * (sizeof(player_id_t) + sizeof(score_t));
+        case GameDelta:
+            return sizeof(uint8_t) + sizeof(uint16_t) + encodedSize(*message.delta) +
+                   sizeof(uint32_t) + message.explosions.size() * POSITION_SIZE;
+    }
+    return sizeof(uint8_t);
+}
+
+// Encodes parts of a message into bytes, which are resized to its exact
+// size once. Parts are written without any capacity checks.
+template <typename... Parts>
+void encodeInto(std::vector<char> &bytes, const Parts &...parts) {
+    bytes.resize((encodedSize(parts) + ...));
+    SpanBuffer buffer(bytes.data(), bytes.size());
+    (buffer << ... << parts);
+}
+
+// Encodes parts of a message into bytes allocated once with exact size,
+// which can be shared by all sessions the message is sent to.
+template <typename... Parts>
+SharedBytes encodeShared(const Parts &...parts) {
+    auto bytes = std::make_shared<std::vector<char>>();
+    encodeInto(*bytes, parts...);
+    return bytes;
+}
+
+/* Checking whether bytes received so far hold a whole server message,
+ * by walking over its length fields without decoding it. */
+
+// Cursor over received bytes, only checking that fields were received.
+class MessageScanner {
+    const char *bytes;
+    size_t length;
+    size_t position = 0;
+
+   public:
+    MessageScanner(const char *b, size_t l) : bytes(b), length(l) {}
+
+    // Skips count bytes. Returns whether they were received.
+    bool skip(size_t count) {
+        if (length - position < count) return false;
+        position += count;
+        return true;
+    }
+
+    // Reads number in network byte order. Returns whether it was received.
+    template <typename Number>
+    bool read(Number &value) {
+        if (length - position < sizeof(Number)) return false;
+        value = 0;
+        for (size_t i = 0; i < sizeof(Number); i++) {
+            value = (Number)(value << 8 | (uint8_t)bytes[position++]);
+        }
+        return true;
+    }
+
+    bool skipString() {
+        uint8_t string_length;
+        return read(string_length) && skip(string_length);
+    }
+
+    bool skipPlayer() { return skipString() && skipString(); }
+};
+
+// Returns whether turn events were received whole.
+inline bool scanEvents(MessageScanner &scanner) {
+    uint32_t count;
+    if (!scanner.read(count)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t event_type;
+        if (!scanner.read(event_type)) return false;
+        // Decoding reports wrong events, they are not waited for.
+        if (event_type > BlockPlaced) return true;
+        if (event_type != BombExploded) {
+            if (!scanner.skip(fixedEventSize((EventType)event_type) - sizeof(uint8_t))) {
+                return false;
+            }
+            continue;
+        }
+        uint32_t robots;
+        uint32_t blocks;
+        if (!scanner.skip(sizeof(bomb_id_t)) || !scanner.read(robots) ||
+            !scanner.skip(robots * sizeof(player_id_t)) || !scanner.read(blocks) ||
+            !scanner.skip(blocks * POSITION_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns whether bytes start with a whole server message. Message of
+// wrong type counts as whole, so that decoding it reports the error.
+inline bool containsServerMessage(std::span<const char> bytes) {
+    MessageScanner scanner(bytes.data(), bytes.size());
+    uint8_t msg_type;
+    if (!scanner.read(msg_type)) return false;
+    switch (msg_type) {
+        case Hello:
+            return scanner.skipString() && scanner.skip(HELLO_FIXED_SIZE - sizeof(uint8_t));
+        case AcceptedPlayer:
+            return scanner.skip(sizeof(player_id_t)) && scanner.skipPlayer();
+        case GameStarted: {
+            uint32_t count;
+            if (!scanner.read(count)) return false;
+            for (uint32_t i = 0; i < count; i++) {
+                if (!scanner.skip(sizeof(player_id_t)) || !scanner.skipPlayer()) return false;
+            }
+            return true;
+        }
+        case Turn:
+            return scanner.skip(sizeof(uint16_t)) && scanEvents(scanner);
+        case GameEnded: {
+            uint32_t count;
+            return scanner.read(count) &&
+                   scanner.skip(count * (sizeof(player_id_t) + sizeof(score_t)));
+        }
+        default:
+            return true;
+    }
+}
+
+// Returns whether bytes start with a whole length prefixed message.
+inline bool containsFrame(std::span<const char> bytes) {
+    MessageScanner scanner(bytes.data(), bytes.size());
+    uint32_t length;
+    return scanner.read(length) && scanner.skip(length);
+}
+
+/* Length prefixed framing, negotiated with EnableFraming and FramingEnabled messages. */
+
+// Writes message prefixed with its length. Message is encoded into frame
+// buffer first, because its length has to be known before it is written.
+template <typename T, typename Message>
+void writeFrame(Buffer<T> &buffer, MemoryBuffer &frame, const Message &message) {
+    frame.clear();
+    frame << message;
+    buffer.writeUint32((uint32_t)frame.length());
+    buffer.writeBytes(frame.data(), frame.length());
+}
+
+// Reads whole length prefixed message into frame buffer,
+// so it can be decoded without reading past its end. Frame longer than
+// max_length is rejected as soon as its prefix is read.
+template <typename T>
+void readFrame(Buffer<T> &buffer, MemoryBuffer &frame, size_t max_length = MAX_FRAME_SIZE) {
+    uint32_t length = buffer.readUint32();
+    if (length == 0 || length > max_length) {
+        throw std::length_error("Wrong frame length received");
+    }
+    frame.clear();
+    buffer.readBytes(frame, length);
+}
+
+// Reads message from a frame with the given function. Messages of types newer
+// than max_type are not read, so peers can add them without breaking older
+// receivers. Returns whether the message was read. Bytes left after the
+// message are ignored for the same reason.
+template <typename Read>
+bool readFromFrame(MemoryBuffer &frame, uint8_t max_type, Read &&read) {
+    if ((uint8_t)*frame.data() > max_type) return false;
+    try {
+        read(frame);
+    } catch (incomplete_message &) {
+        throw std::invalid_argument("Message is longer than its frame");
+    }
+    return true;
+}
+
+// Decodes message from a frame, like readFromFrame.
+template <typename Message>
+bool decodeFrame(MemoryBuffer &frame, Message &message, uint8_t max_type) {
+    return readFromFrame(frame, max_type, [&message](MemoryBuffer &from) { from >> message; });
+}
+
 #endif  // BOMBERMAN_SERIALIZATION_HPP
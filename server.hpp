@@ -0,0 +1,262 @@
+/* Server hosting many independent games in one process. Every thread runs
+ * its own io_context and every game is pinned to one of them, so games run
+ * in parallel without sharing any state. New clients join an open lobby,
+ * and when no lobby is open a new game is created for them. Lobby is open
+ * until its game starts and again after the game ends, if some of its
+ * clients stay. Only the game's thread knows for sure whether its lobby is
+ * open, so clients reaching a game that has closed it are sent back to
+ * the acceptor. */
+
+#ifndef BOMBERMAN_SERVER_HPP
+#define BOMBERMAN_SERVER_HPP
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "definitions.hpp"
+#include "game.hpp"
+#include "spectators.hpp"
+#include "uring.hpp"
+
+using boost::asio::ip::tcp;
+
+// Runs io_context until it is stopped, logging errors thrown by handlers.
+void run_io_context(boost::asio::io_context &io_context) {
+    while (true) {
+        try {
+            io_context.run();
+            break;
+        } catch (std::exception &e) {
+            std::cerr << "error: " << e.what() << '\n';
+        }
+    }
+}
+
+class Server {
+   private:
+    using work_guard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+    server_parameters settings;
+
+    // Accepting connections and bookkeeping of games happens only here.
+    boost::asio::io_context acceptor_context;
+    tcp::acceptor acceptor{acceptor_context, tcp::endpoint(tcp::v6(), settings.port)};
+
+    // One io_context per game thread.
+    std::vector<std::unique_ptr<boost::asio::io_context>> game_contexts;
+    std::vector<work_guard> work_guards;
+    std::vector<std::thread> threads;
+    size_t next_context = 0;
+
+#ifdef BOMBERMAN_HAS_IO_URING
+    // Rings of the io_uring backend, one for the acceptor and one per game thread.
+    std::unique_ptr<UringLoop> acceptor_loop;
+    std::vector<std::unique_ptr<UringLoop>> game_loops;
+    UringOperation accept_operation;
+#endif
+
+    // Feed for spectators, running on its own thread, if it is enabled.
+    std::unique_ptr<SpectatorFeed> spectators;
+
+    size_t next_game_id = 0;
+    std::map<class Game *, std::shared_ptr<class Game>> games;
+    // Games with lobbies waiting for players, new clients are sent to the
+    // first one. Lobbies reopened after a game come first, as their clients
+    // have been waiting already.
+    std::deque<std::shared_ptr<class Game>> open_games;
+
+    // Creates game on the next thread in round robin order.
+    std::shared_ptr<class Game> create_game() {
+        boost::asio::io_context &context = *game_contexts[next_context];
+        next_context = (next_context + 1) % game_contexts.size();
+
+        // Notifications from games are handled on the acceptor thread.
+        auto game = std::make_shared<class Game>(
+            settings, next_game_id++, context,
+            [this](class Game *g) {
+                boost::asio::post(acceptor_context, [this, g]() { handle_started(g); });
+            },
+            [this](class Game *g) {
+                boost::asio::post(acceptor_context, [this, g]() { handle_reopened(g); });
+            },
+            [this](class Game *g) {
+                boost::asio::post(acceptor_context, [this, g]() { handle_idle(g); });
+            },
+            spectators.get());
+        games[game.get()] = game;
+        return game;
+    }
+
+    void close_lobby(class Game *game) {
+        auto it = std::find_if(open_games.begin(), open_games.end(),
+                               [game](const auto &open) { return open.get() == game; });
+        if (it != open_games.end()) open_games.erase(it);
+    }
+
+    // Lobby of the game is full, so following clients go to another game.
+    void handle_started(class Game *game) { close_lobby(game); }
+
+    // Game ended and its clients wait for new players.
+    void handle_reopened(class Game *game) {
+        auto it = games.find(game);
+        if (it != games.end()) open_games.push_front(it->second);
+    }
+
+    // Game without clients is removed. It has closed its lobby already.
+    void handle_idle(class Game *game) {
+        close_lobby(game);
+        auto it = games.find(game);
+        if (it == games.end()) return;
+        std::shared_ptr<class Game> removed = std::move(it->second);
+        games.erase(it);
+        // Game is destroyed on its own thread, after its pending handlers.
+        boost::asio::io_context &context = removed->get_io_context();
+        boost::asio::post(context, [removed = std::move(removed)]() {});
+    }
+
+    // Returns game whose lobby the next client joins.
+    std::shared_ptr<class Game> lobby() {
+        if (open_games.empty()) {
+            open_games.push_back(create_game());
+        }
+        return open_games.front();
+    }
+
+    // Moves accepted connection to the open game's io_context,
+    // so from now on it is served only by the game's thread.
+    void handle_accepted(tcp::socket socket) {
+        std::shared_ptr<class Game> game = lobby();
+        boost::asio::io_context &context = game->get_io_context();
+        tcp protocol = socket.local_endpoint().protocol();
+        tcp::socket game_socket(context, protocol, socket.release());
+        boost::asio::post(context, [this, game, &context, s = std::move(game_socket)]() mutable {
+            // Lobby closed before the acceptor learned about it. Notification
+            // is already posted, so the client gets another lobby.
+            if (!game->is_open()) {
+                boost::asio::post(acceptor_context, [this, s = std::move(s)]() mutable {
+                    handle_accepted(std::move(s));
+                });
+                return;
+            }
+            try {
+                game->handle_connection(std::make_shared<AsioSession>(context, std::move(s)));
+            } catch (std::exception &e) {
+                std::cerr << "error: " << e.what() << '\n';
+            }
+        });
+    }
+
+    void accept() {
+        acceptor.async_accept([this](const boost::system::error_code &error, tcp::socket socket) {
+            if (!error) {
+                try {
+                    handle_accepted(std::move(socket));
+                } catch (std::exception &e) {
+                    std::cerr << "error: " << e.what() << '\n';
+                }
+            }
+            accept();
+        });
+    }
+
+#ifdef BOMBERMAN_HAS_IO_URING
+    // Passes accepted socket to the ring of the open game's thread.
+    void handle_accepted(int fd) {
+        std::shared_ptr<class Game> game = lobby();
+        boost::asio::io_context &context = game->get_io_context();
+        UringLoop *loop = nullptr;
+        for (auto &game_loop : game_loops) {
+            if (&game_loop->get_io_context() == &context) loop = game_loop.get();
+        }
+        boost::asio::post(context, [this, game, loop, fd]() {
+            if (!game->is_open()) {
+                boost::asio::post(acceptor_context, [this, fd]() { handle_accepted(fd); });
+                return;
+            }
+            try {
+                game->handle_connection(std::make_shared<UringSession>(*loop, fd));
+            } catch (std::exception &e) {
+                std::cerr << "error: " << e.what() << '\n';
+            }
+        });
+    }
+
+    // Accepts all connections with one multishot operation,
+    // which is started again only if it stops after an error.
+    void accept_with_uring() {
+        accept_operation.handler = [this](int result, uint32_t flags) {
+            if (result >= 0) {
+                handle_accepted(result);
+            } else {
+                std::cerr << "error: accept: " << strerror(-result) << '\n';
+            }
+            if (!(flags & IORING_CQE_F_MORE)) accept_with_uring();
+        };
+        acceptor_loop->accept_multishot(acceptor.native_handle(), accept_operation);
+    }
+#endif
+
+   public:
+    explicit Server(const server_parameters &launch_settings) : settings(launch_settings) {
+        size_t threads_count = std::max<size_t>(settings.threads, 1);
+        for (size_t i = 0; i < threads_count; i++) {
+            game_contexts.push_back(std::make_unique<boost::asio::io_context>(1));
+            work_guards.push_back(boost::asio::make_work_guard(*game_contexts.back()));
+        }
+        if (settings.backend == UringBackend) {
+#ifdef BOMBERMAN_HAS_IO_URING
+            acceptor_loop = std::make_unique<UringLoop>(acceptor_context);
+            for (auto &context : game_contexts) {
+                game_loops.push_back(std::make_unique<UringLoop>(*context));
+            }
+#else
+            throw std::runtime_error("io_uring backend is not supported on this system");
+#endif
+        }
+        if (settings.spectator_port != 0) {
+            spectators = std::make_unique<SpectatorFeed>(settings.spectator_port);
+        }
+    }
+
+    void run() {
+        std::cout << "Accepting connections on port " << settings.port << " with "
+                  << game_contexts.size() << " game threads, using "
+                  << (settings.backend == UringBackend ? "io_uring" : "asio") << " backend\n";
+        for (auto &context : game_contexts) {
+            threads.emplace_back([&context]() { run_io_context(*context); });
+        }
+        if (spectators) {
+            std::cout << "Serving spectators on UDP port " << settings.spectator_port << '\n';
+            spectators->start();
+            threads.emplace_back([this]() { run_io_context(spectators->get_io_context()); });
+        }
+#ifdef BOMBERMAN_HAS_IO_URING
+        if (acceptor_loop) {
+            accept_with_uring();
+        } else {
+            accept();
+        }
+#else
+        accept();
+#endif
+        run_io_context(acceptor_context);
+
+        for (auto &guard : work_guards) {
+            guard.reset();
+        }
+        if (spectators) spectators->get_io_context().stop();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+#endif  // BOMBERMAN_SERVER_HPP
@@ -0,0 +1,283 @@
+#ifndef BOMBERMAN_SESSION_HPP
+#define BOMBERMAN_SESSION_HPP
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "buffer.hpp"
+#include "definitions.hpp"
+#include "serialization.hpp"
+
+using boost::asio::ip::tcp;
+
+// Number of bytes we try to read from client socket at once.
+static const size_t SESSION_READ_SIZE = 512;
+// Default limit of bytes queued for a client.
+static const size_t SESSION_OUTPUT_LIMIT = 1 << 20;
+
+std::string address_from_endpoint(const tcp::endpoint &endpoint) {
+    std::string s = endpoint.address().to_string();
+    uint16_t client_port = endpoint.port();
+    std::string client_port_string = std::to_string(client_port);
+    s.append(":");
+    s.append(client_port_string);
+    return s;
+}
+
+// Encoded FramingEnabled message, the same for all sessions.
+const SharedBytes &framing_enabled_message() {
+    static const SharedBytes message =
+        std::make_shared<const std::vector<char>>(1, (char)FramingEnabled);
+    return message;
+}
+
+// Class representing single client connected to the server. It decodes
+// messages and queues messages to send, socket operations are done by
+// the deriving class of the I/O backend. All of them are asynchronous,
+// so many sessions can be served by one thread running the io_context.
+class Session : public std::enable_shared_from_this<Session> {
+   public:
+    using message_handler =
+        std::function<void(const std::shared_ptr<Session> &, const ClientMessage &)>;
+    using close_handler = std::function<void(const std::shared_ptr<Session> &)>;
+
+   private:
+    boost::asio::io_context &io_context;
+
+    // Encoded messages waiting to be sent, starting with the ones being written.
+    std::deque<SharedBytes> output;
+    // Messages being written, gathered into one buffer sequence.
+    std::vector<boost::asio::const_buffer> gathered;
+    // Length prefixes of messages being written, in network byte order.
+    std::vector<uint32_t> prefixes;
+    // Number of messages from the front of output being written.
+    size_t writing_count = 0;
+    bool writing = false;
+    bool flush_scheduled = false;
+
+    // Client that does not receive fast enough is disconnected, so messages
+    // waiting behind the write in progress never take more than output_limit
+    // bytes and one more message.
+    size_t output_limit = SESSION_OUTPUT_LIMIT;
+    bool too_slow = false;
+    // Bytes of messages in output, including the ones being written.
+    size_t output_bytes = 0;
+    size_t writing_bytes = 0;
+    size_t peak_output_bytes = 0;
+
+    // Whether client asked for length prefixed messages. Then the first
+    // unframed_output messages in output are still sent without prefix.
+    bool framing = false;
+    size_t unframed_output = 0;
+    MemoryBuffer frame;
+
+    ClientMessage client_message;
+    message_handler on_message;
+    close_handler on_close;
+
+   protected:
+    std::string address;
+    MemoryBuffer input;
+    bool closed = false;
+
+    // Starts receiving bytes into input. After every read the backend
+    // commits them and calls handle_received.
+    virtual void read() = 0;
+    // Writes all gathered buffers and then calls handle_written.
+    virtual void write_gathered(std::span<const boost::asio::const_buffer> buffers) = 0;
+    virtual void close_socket() = 0;
+
+    // Decodes messages received so far. Returns whether session is still open.
+    bool handle_received() {
+        try {
+            handle_input();
+        } catch (std::exception &e) {
+            std::cerr << "error: " << e.what() << " from " << address << '\n';
+            close();
+        }
+        return !closed;
+    }
+
+    void handle_written(bool success) {
+        writing = false;
+        output_bytes -= writing_bytes;
+        writing_bytes = 0;
+        output.erase(output.begin(), output.begin() + (ptrdiff_t)writing_count);
+        unframed_output -= std::min(unframed_output, writing_count);
+        if (closed) return;
+        if (!success) {
+            close();
+            return;
+        }
+        write();
+    }
+
+    // Decodes all complete messages from input buffer.
+    // Incomplete message is left in the buffer until more bytes arrive.
+    void handle_input() {
+        auto self = shared_from_this();
+        while (!closed && input.length() > 0) {
+            size_t message_start = input.readPosition();
+            try {
+                if (framing) {
+                    readFrame(input, frame, MAX_CLIENT_FRAME_SIZE);
+                } else {
+                    input >> client_message;
+                }
+            } catch (incomplete_message &) {
+                input.rewind(message_start);
+                break;
+            }
+            if (framing && !decodeFrame(frame, client_message, EnableFraming)) continue;
+            if (client_message.msg_type == EnableFraming) {
+                enable_framing();
+                continue;
+            }
+            on_message(self, client_message);
+        }
+        input.discardRead();
+    }
+
+    // Confirms framing to the client. Messages queued so far and the
+    // confirmation are sent as they are, all following ones with length prefix.
+    void enable_framing() {
+        if (framing) return;
+        send(framing_enabled_message());
+        framing = true;
+        unframed_output = output.size();
+    }
+
+    // Disconnects client over the output limit.
+    void disconnect_too_slow() {
+        std::cerr << "error: " << address << " does not receive messages, disconnecting\n";
+        // Session is closed later, as it may be sent to while iterating sessions.
+        too_slow = true;
+        boost::asio::post(io_context, [this, self = shared_from_this()]() { close(); });
+    }
+
+    // Writes all queued messages at once, with a single vectored write.
+    void write() {
+        if (writing || closed || output.empty()) return;
+        writing = true;
+        gathered.clear();
+        prefixes.resize(output.size());
+        for (size_t i = 0; i < output.size(); i++) {
+            if (framing && i >= unframed_output) {
+                prefixes[i] = htonl((uint32_t)output[i]->size());
+                gathered.push_back(boost::asio::buffer(&prefixes[i], sizeof(uint32_t)));
+            }
+            gathered.push_back(boost::asio::buffer(*output[i]));
+        }
+        writing_count = output.size();
+        writing_bytes = output_bytes;
+        write_gathered(gathered);
+    }
+
+   public:
+    // Id of the player if this client was accepted to the game.
+    std::optional<player_id_t> player_id;
+
+    explicit Session(boost::asio::io_context &context) : io_context(context) {}
+
+    virtual ~Session() = default;
+
+    [[nodiscard]] const std::string &get_address() const { return address; }
+
+    [[nodiscard]] size_t get_output_bytes() const { return output_bytes; }
+
+    [[nodiscard]] size_t get_output_messages() const { return output.size(); }
+
+    [[nodiscard]] size_t get_peak_output_bytes() const { return peak_output_bytes; }
+
+    // Sets how many bytes can be queued for the client before it is disconnected.
+    void set_output_limit(size_t limit) { output_limit = limit; }
+
+    // Starts receiving messages from the client.
+    void start(message_handler message_h, close_handler close_h) {
+        on_message = std::move(message_h);
+        on_close = std::move(close_h);
+        read();
+    }
+
+    // Queues encoded message to be sent to the client. Messages queued
+    // by one handler, like a whole turn or a burst of lobby messages,
+    // are written together after the handler returns.
+    void send(SharedBytes message) {
+        if (closed || too_slow) return;
+        // Only messages waiting before this one count, so a message longer
+        // than the limit is still sent to a client that keeps up.
+        size_t waiting_bytes = output_bytes - writing_bytes;
+        output_bytes += message->size();
+        output.push_back(std::move(message));
+        if (waiting_bytes > output_limit) {
+            disconnect_too_slow();
+            return;
+        }
+        peak_output_bytes = std::max(peak_output_bytes, output_bytes);
+        if (writing || flush_scheduled) return;
+        flush_scheduled = true;
+        boost::asio::post(io_context, [this, self = shared_from_this()]() {
+            flush_scheduled = false;
+            write();
+        });
+    }
+
+    void close() {
+        if (closed) return;
+        closed = true;
+        close_socket();
+        on_close(shared_from_this());
+    }
+};
+
+// Session of the default backend, using asio sockets.
+class AsioSession : public Session {
+    tcp::socket socket;
+
+    void read() override {
+        auto self = shared_from_this();
+        socket.async_read_some(
+            boost::asio::buffer(input.prepare(SESSION_READ_SIZE), SESSION_READ_SIZE),
+            [this, self](const boost::system::error_code &error, size_t received) {
+                if (closed) return;
+                if (error) {
+                    close();
+                    return;
+                }
+                input.commit(received);
+                if (handle_received()) read();
+            });
+    }
+
+    void write_gathered(std::span<const boost::asio::const_buffer> buffers) override {
+        boost::asio::async_write(
+            socket, buffers,
+            [this, self = shared_from_this()](const boost::system::error_code &error, size_t) {
+                handle_written(!error);
+            });
+    }
+
+    void close_socket() override {
+        boost::system::error_code ignored;
+        socket.shutdown(tcp::socket::shutdown_both, ignored);
+        socket.close(ignored);
+    }
+
+   public:
+    // Socket has to use the io_context of the game, which the session belongs to.
+    AsioSession(boost::asio::io_context &context, tcp::socket s)
+        : Session(context), socket(std::move(s)) {
+        address = address_from_endpoint(socket.remote_endpoint());
+        socket.set_option(tcp::no_delay(true));
+    }
+};
+
+#endif  // BOMBERMAN_SESSION_HPP
@@ -0,0 +1,423 @@
+/* Read-only feed of all games for spectators, like dashboards and stream
+ * overlays. Spectator registers by sending a Subscribe request to the
+ * spectator port and has to repeat it at least every SPECTATOR_TIMEOUT.
+ * Then it receives every message broadcast to players of any game, in the
+ * same encoding as over TCP, prefixed with uint32 id of the game.
+ *
+ * Right after subscribing, spectator gets Hello of every game and messages
+ * of its lobby: AcceptedPlayer messages and GameStarted if it has started.
+ * For games in progress it gets Snapshot after the next turn, with the
+ * whole state of the game: turn, players, positions of robots, blocks,
+ * bombs and scores. They are encoded like in Game message to the GUI,
+ * except that every bomb starts with its uint32 id. Turn messages with
+ * numbers not greater than the turn of a snapshot are already applied to
+ * it and have to be skipped.
+ *
+ * Datagram carries at most UDP_BUFF_SIZE bytes, id of the game included.
+ * Longer Turn is sent as several Turn messages with the same number, with
+ * consecutive parts of its events. Other longer messages and events, such
+ * as Snapshot of a huge board, are replaced with MessageDropped followed
+ * by the type of the dropped message.
+ *
+ * Requests are SPECTATOR_REQUEST_SIZE bytes: the request type, three zero
+ * bytes and an 8 byte cookie. Request with a cookie that is not valid for
+ * the sender's address is answered with the datagram of the same size,
+ * carrying game id COOKIE_GAME_ID and a valid cookie in place of a message.
+ * The spectator repeats its request with that cookie. So only addresses
+ * that receive datagrams can subscribe, and the server can not be used to
+ * flood addresses it gets in forged requests. */
+
+#ifndef BOMBERMAN_SPECTATORS_HPP
+#define BOMBERMAN_SPECTATORS_HPP
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <boost/asio.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "buffer.hpp"
+#include "definitions.hpp"
+#include "serialization.hpp"
+
+using boost::asio::ip::udp;
+
+// Spectator is forgotten if it does not renew its subscription for this long.
+static const std::chrono::seconds SPECTATOR_TIMEOUT(30);
+// Limit of spectators, so registrations can not take all memory.
+static const size_t MAX_SPECTATORS = 65536;
+// Number of datagrams passed to a single sendmmsg call.
+static const size_t SENDMMSG_BATCH = 1024;
+// Socket buffer sizes, big enough for a message sent to thousands of
+// spectators and for a burst of their subscriptions.
+static const int SPECTATOR_SEND_BUFF_SIZE = 4 << 20;
+static const int SPECTATOR_RECEIVE_BUFF_SIZE = 4 << 20;
+
+// Size of spectator requests and of replies carrying a cookie.
+static const size_t SPECTATOR_REQUEST_SIZE = 12;
+// Offset of the cookie, the same in requests and in replies.
+static const size_t SPECTATOR_COOKIE_OFFSET = 4;
+// Game id of replies carrying a cookie.
+static const uint32_t COOKIE_GAME_ID = UINT32_MAX;
+
+enum SpectatorRequest : uint8_t {
+    Subscribe = 0,
+    Unsubscribe = 1
+};
+
+// Keyed hash SipHash-2-4, it can not be predicted without the key.
+uint64_t siphash(const std::array<uint64_t, 2> &key, std::span<const uint8_t> data) {
+    uint64_t v0 = 0x736f6d6570736575 ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6d ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261 ^ key[0];
+    uint64_t v3 = 0x7465646279746573 ^ key[1];
+    auto round = [&]() {
+        v0 += v1;
+        v1 = std::rotl(v1, 13) ^ v0;
+        v0 = std::rotl(v0, 32);
+        v2 += v3;
+        v3 = std::rotl(v3, 16) ^ v2;
+        v0 += v3;
+        v3 = std::rotl(v3, 21) ^ v0;
+        v2 += v1;
+        v1 = std::rotl(v1, 17) ^ v2;
+        v2 = std::rotl(v2, 32);
+    };
+    auto compress = [&](uint64_t word) {
+        v3 ^= word;
+        round();
+        round();
+        v0 ^= word;
+    };
+
+    // Words are read in little endian order, the last one holds the length.
+    uint64_t word = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+        word |= (uint64_t)data[i] << (8 * (i % 8));
+        if (i % 8 == 7) {
+            compress(word);
+            word = 0;
+        }
+    }
+    compress(word | (uint64_t)data.size() << 56);
+
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++) round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Sends messages to spectators from its own io_context, run by a separate
+// thread, so the number of spectators does not affect turns of games. Every
+// message is sent to all of them with a few sendmmsg calls.
+class SpectatorFeed {
+    struct Spectator {
+        udp::endpoint endpoint;
+        std::chrono::steady_clock::time_point last_seen;
+        // Number of the subscription, counted from 1.
+        uint64_t subscription{};
+    };
+
+    boost::asio::io_context io_context{1};
+    udp::socket socket;
+
+    std::vector<Spectator> spectators;
+    std::map<udp::endpoint, size_t> indexes;
+    std::chrono::steady_clock::time_point last_expiry_check;
+
+    // Headers of datagrams for sendmmsg, reused between messages.
+    std::vector<mmsghdr> headers;
+    // Parts of datagrams sent to a new spectator, the game id and the message.
+    std::vector<uint32_t> log_prefixes;
+    std::vector<std::array<iovec, 2>> log_parts;
+
+    // Number of subscriptions so far, games read it from their threads.
+    std::atomic<uint64_t> subscriptions{0};
+    // Hello of every game and messages of its lobby, sent to new spectators.
+    std::map<uint32_t, std::vector<SharedBytes>> lobby_logs;
+
+    std::array<char, 16> request{};
+    udp::endpoint sender;
+
+    // Key of cookies, random for every run of the server.
+    std::array<uint64_t, 2> cookie_key{};
+
+    // Cookie of the address for the given period of SPECTATOR_TIMEOUT.
+    [[nodiscard]] uint64_t make_cookie(const udp::endpoint &endpoint, uint64_t period) const {
+        std::array<uint8_t, 26> data{};
+        auto address = endpoint.address().to_v6().to_bytes();
+        std::copy(address.begin(), address.end(), data.begin());
+        data[16] = (uint8_t)(endpoint.port() >> 8);
+        data[17] = (uint8_t)endpoint.port();
+        for (size_t i = 0; i < sizeof(period); i++) {
+            data[18 + i] = (uint8_t)(period >> (8 * i));
+        }
+        return siphash(cookie_key, data);
+    }
+
+    [[nodiscard]] static uint64_t current_period() {
+        return (uint64_t)(std::chrono::steady_clock::now().time_since_epoch() / SPECTATOR_TIMEOUT);
+    }
+
+    // Cookie is valid in the period it was made in and in the next one,
+    // so spectator renewing its subscription in time gets a new one at most
+    // once per SPECTATOR_TIMEOUT.
+    [[nodiscard]] bool valid_cookie(const udp::endpoint &endpoint, uint64_t cookie) const {
+        uint64_t period = current_period();
+        return cookie == make_cookie(endpoint, period) ||
+               cookie == make_cookie(endpoint, period - 1);
+    }
+
+    // Sends the address a cookie, in the datagram as long as its request.
+    void send_cookie(const udp::endpoint &endpoint) {
+        std::array<char, SPECTATOR_REQUEST_SIZE> reply{};
+        uint32_t prefix = htonl(COOKIE_GAME_ID);
+        uint64_t cookie = make_cookie(endpoint, current_period());
+        memcpy(reply.data(), &prefix, sizeof(prefix));
+        memcpy(reply.data() + SPECTATOR_COOKIE_OFFSET, &cookie, sizeof(cookie));
+        boost::system::error_code ignored;
+        socket.send_to(boost::asio::buffer(reply), endpoint, 0, ignored);
+    }
+
+    void handle_request() {
+        uint64_t cookie;
+        memcpy(&cookie, request.data() + SPECTATOR_COOKIE_OFFSET, sizeof(cookie));
+        if (!valid_cookie(sender, cookie)) {
+            send_cookie(sender);
+        } else if (request[0] == Subscribe) {
+            add_or_renew(sender);
+        } else if (request[0] == Unsubscribe) {
+            auto it = indexes.find(sender);
+            if (it != indexes.end()) remove(it->second);
+        }
+    }
+
+    void add_or_renew(const udp::endpoint &endpoint) {
+        auto now = std::chrono::steady_clock::now();
+        auto it = indexes.find(endpoint);
+        if (it != indexes.end()) {
+            spectators[it->second].last_seen = now;
+        } else if (spectators.size() < MAX_SPECTATORS) {
+            indexes[endpoint] = spectators.size();
+            uint64_t subscription = subscriptions.load(std::memory_order_relaxed) + 1;
+            spectators.push_back({endpoint, now, subscription});
+            subscriptions.store(subscription, std::memory_order_relaxed);
+            send_lobby_logs(endpoint);
+        }
+    }
+
+    // Sends lobby logs of all games to a new spectator.
+    void send_lobby_logs(const udp::endpoint &endpoint) {
+        size_t count = 0;
+        for (const auto &[game_id, log] : lobby_logs) {
+            count += log.size();
+        }
+        log_prefixes.resize(count);
+        log_parts.resize(count);
+        headers.resize(count);
+        size_t i = 0;
+        for (const auto &[game_id, log] : lobby_logs) {
+            for (const auto &message : log) {
+                log_prefixes[i] = htonl(game_id);
+                log_parts[i][0] = {&log_prefixes[i], sizeof(uint32_t)};
+                log_parts[i][1] = {const_cast<char *>(message->data()), message->size()};
+                set_header(headers[i], endpoint, log_parts[i]);
+                i++;
+            }
+        }
+        send_headers(count);
+    }
+
+    // Keeps messages that a new spectator needs to follow the game.
+    void record(uint32_t game_id, const SharedBytes &message) {
+        std::vector<SharedBytes> &log = lobby_logs[game_id];
+        switch ((uint8_t)message->front()) {
+            case Hello:
+                log.assign(1, message);
+                break;
+            case AcceptedPlayer:
+            case GameStarted:
+                log.push_back(message);
+                break;
+            case GameEnded:
+                // Lobby is opened again, only Hello is still valid.
+                log.resize(std::min<size_t>(log.size(), 1));
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Removes spectator by moving the last one in its place.
+    void remove(size_t index) {
+        indexes.erase(spectators[index].endpoint);
+        if (index + 1 != spectators.size()) {
+            spectators[index] = spectators.back();
+            indexes[spectators[index].endpoint] = index;
+        }
+        spectators.pop_back();
+    }
+
+    // Removes spectators that did not renew subscription in time, once a second.
+    void remove_expired() {
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_expiry_check < std::chrono::seconds(1)) return;
+        last_expiry_check = now;
+        for (size_t i = spectators.size(); i-- > 0;) {
+            if (now - spectators[i].last_seen > SPECTATOR_TIMEOUT) {
+                remove(i);
+            }
+        }
+    }
+
+    void receive() {
+        socket.async_receive_from(
+            boost::asio::buffer(request), sender,
+            [this](const boost::system::error_code &error, size_t received) {
+                if (error == boost::asio::error::operation_aborted) return;
+                if (!error && received == SPECTATOR_REQUEST_SIZE) handle_request();
+                receive();
+            });
+    }
+
+    static void set_header(mmsghdr &datagram,
+                           const udp::endpoint &endpoint,
+                           std::array<iovec, 2> &parts) {
+        msghdr &header = datagram.msg_hdr;
+        header = {};
+        header.msg_name = const_cast<sockaddr *>(endpoint.data());
+        header.msg_namelen = (socklen_t)endpoint.size();
+        header.msg_iov = parts.data();
+        header.msg_iovlen = parts.size();
+    }
+
+    // Sends the first count datagrams of headers with as few sendmmsg calls
+    // as the socket buffer allows.
+    void send_headers(size_t count) {
+        size_t sent = 0;
+        while (sent < count) {
+            auto batch = (unsigned)std::min(count - sent, SENDMMSG_BATCH);
+            int result = sendmmsg(socket.native_handle(), headers.data() + sent, batch, 0);
+            if (result >= 0) {
+                sent += (size_t)result;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Send buffer is full, this thread can wait until it drains.
+                boost::system::error_code ignored;
+                socket.wait(udp::socket::wait_write, ignored);
+            } else if (errno != EINTR) {
+                // Datagram to this spectator can not be sent, skip it.
+                sent++;
+            }
+        }
+    }
+
+    // Sends message to spectators with subscriptions later than after, or to
+    // all of them. All datagrams share the same two parts, the game id and
+    // the message, and differ only in address.
+    void fan_out(uint32_t game_id, const SharedBytes &message, uint64_t after = 0) {
+        remove_expired();
+        if (spectators.empty()) return;
+        if (sizeof(uint32_t) + message->size() > UDP_BUFF_SIZE) {
+            fan_out_oversized(game_id, message, after);
+            return;
+        }
+
+        uint32_t prefix = htonl(game_id);
+        std::array<iovec, 2> parts{};
+        parts[0] = {&prefix, sizeof(prefix)};
+        parts[1] = {const_cast<char *>(message->data()), message->size()};
+
+        headers.resize(spectators.size());
+        size_t count = 0;
+        for (const auto &spectator : spectators) {
+            if (spectator.subscription > after) {
+                set_header(headers[count++], spectator.endpoint, parts);
+            }
+        }
+        send_headers(count);
+    }
+
+    // Sends message that does not fit in a datagram. Turn is split into parts
+    // as long as they fit, the rest is replaced with MessageDropped.
+    void fan_out_oversized(uint32_t game_id, const SharedBytes &message, uint64_t after) {
+        static const size_t max_size = UDP_BUFF_SIZE - sizeof(uint32_t);
+        static const size_t empty_turn_size = TURN_HEADER_SIZE + sizeof(uint32_t);
+        auto type = (uint8_t)message->front();
+        if (type == Turn) {
+            ServerMessage turn;
+            SpanBuffer decoder(message->data(), message->size());
+            decoder >> turn;
+            std::span<const Event> events(turn.events.data(), turn.events.size());
+            size_t first = 0;
+            size_t size = empty_turn_size;
+            for (size_t i = 0; i <= events.size(); i++) {
+                size_t event_size = i < events.size() ? encodedSize(events[i]) : 0;
+                if (i == events.size() || size + event_size > max_size) {
+                    if (i > first) {
+                        fan_out(game_id,
+                                encodeShared(type, turn.turn, events.subspan(first, i - first)),
+                                after);
+                    }
+                    first = i;
+                    size = empty_turn_size;
+                }
+                if (empty_turn_size + event_size > max_size) break;
+                size += event_size;
+            }
+            if (first == events.size()) return;
+        }
+        fan_out(game_id, encodeShared((uint8_t)MessageDropped, type), after);
+    }
+
+   public:
+    explicit SpectatorFeed(uint16_t port) : socket(io_context, udp::endpoint(udp::v6(), port)) {
+        std::random_device device;
+        for (auto &part : cookie_key) {
+            part = (uint64_t)device() << 32 | device();
+        }
+        socket.set_option(boost::asio::socket_base::send_buffer_size(SPECTATOR_SEND_BUFF_SIZE));
+        socket.set_option(
+            boost::asio::socket_base::receive_buffer_size(SPECTATOR_RECEIVE_BUFF_SIZE));
+    }
+
+    [[nodiscard]] boost::asio::io_context &get_io_context() { return io_context; }
+
+    // Starts accepting subscriptions, io_context has to be run afterwards.
+    void start() { receive(); }
+
+    // Queues message to be sent to spectators. Can be called from any thread
+    // and does not wait for sending, so it costs a game only one post.
+    void publish(size_t game_id, SharedBytes message) {
+        boost::asio::post(io_context, [this, game_id, message = std::move(message)]() {
+            record((uint32_t)game_id, message);
+            fan_out((uint32_t)game_id, message);
+        });
+    }
+
+    // Number of subscriptions so far. Can be called from any thread.
+    [[nodiscard]] uint64_t get_subscriptions() const {
+        return subscriptions.load(std::memory_order_relaxed);
+    }
+
+    // Queues message only for spectators with subscriptions later than after.
+    void publish_to_later(size_t game_id, SharedBytes message, uint64_t after) {
+        boost::asio::post(io_context, [this, game_id, message = std::move(message), after]() {
+            fan_out((uint32_t)game_id, message, after);
+        });
+    }
+
+    // Forgets messages of the game, after it is removed.
+    void remove_game(size_t game_id) {
+        boost::asio::post(io_context, [this, game_id]() { lobby_logs.erase((uint32_t)game_id); });
+    }
+};
+
+#endif  // BOMBERMAN_SPECTATORS_HPP
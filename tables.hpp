@@ -0,0 +1,250 @@
+/* Flat tables for game state kept by the client. Player ids are one byte,
+ * so values indexed by them are kept in arrays with a bitmap of present ids.
+ * Bomb ids are four bytes, so bombs are kept in an open addressing hash table.
+ * Neither of them allocates per element, and both are iterated linearly. */
+
+#ifndef BOMBERMAN_TABLES_HPP
+#define BOMBERMAN_TABLES_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Number of different player ids.
+static const size_t PLAYER_IDS = UINT8_MAX + 1;
+
+// Values indexed by player id, iterated in order of ids like std::map.
+template <typename T>
+class PlayerTable {
+    static const size_t WORD_BITS = 64;
+
+    std::array<T, PLAYER_IDS> values{};
+    std::array<uint64_t, PLAYER_IDS / WORD_BITS> present{};
+    size_t count = 0;
+
+   public:
+    using key_type = uint8_t;
+    using mapped_type = T;
+
+    // Iterator over present ids, giving pairs of id and value like std::map.
+    // It keeps bits of the current bitmap word which are left to visit.
+    class const_iterator {
+        const PlayerTable *table;
+        size_t word;
+        uint64_t bits;
+
+        void skip_empty_words() {
+            while (bits == 0 && ++word < table->present.size()) {
+                bits = table->present[word];
+            }
+        }
+
+       public:
+        const_iterator(const PlayerTable *t, size_t w) : table(t), word(w), bits(0) {
+            if (word < table->present.size()) {
+                bits = table->present[word];
+                skip_empty_words();
+            }
+        }
+
+        std::pair<key_type, const T &> operator*() const {
+            size_t id = word * WORD_BITS + (size_t)std::countr_zero(bits);
+            return {(key_type)id, table->values[id]};
+        }
+
+        const_iterator &operator++() {
+            bits &= bits - 1;
+            skip_empty_words();
+            return *this;
+        }
+
+        bool operator==(const const_iterator &that) const {
+            return word == that.word && bits == that.bits;
+        }
+    };
+
+    [[nodiscard]] const_iterator begin() const { return {this, 0}; }
+
+    [[nodiscard]] const_iterator end() const { return {this, present.size()}; }
+
+    [[nodiscard]] size_t size() const { return count; }
+
+    [[nodiscard]] bool empty() const { return count == 0; }
+
+    [[nodiscard]] bool contains(key_type id) const {
+        return (present[id / WORD_BITS] >> (id % WORD_BITS) & 1) != 0;
+    }
+
+    // Returns value of the player, inserting default one if there was none.
+    T &operator[](key_type id) {
+        if (!contains(id)) {
+            present[id / WORD_BITS] |= (uint64_t)1 << (id % WORD_BITS);
+            values[id] = T{};
+            count++;
+        }
+        return values[id];
+    }
+
+    void erase(key_type id) {
+        if (!contains(id)) return;
+        present[id / WORD_BITS] &= ~((uint64_t)1 << (id % WORD_BITS));
+        count--;
+    }
+
+    void clear() {
+        present.fill(0);
+        count = 0;
+    }
+
+    // Replaces contents with elements of a map with the same keys.
+    template <typename Map>
+    void assign(const Map &elements) {
+        clear();
+        for (const auto &elem : elements) {
+            (*this)[elem.first] = elem.second;
+        }
+    }
+};
+
+// Values indexed by bomb id in a hash table with linear probing. Erased
+// elements are filled by shifting the following ones back, so there are
+// no tombstones and lookups stop at the first free slot. Slots are kept
+// when the table is cleared, so a table reused between games stops allocating.
+template <typename T>
+class BombTable {
+    static const size_t MIN_CAPACITY = 16;
+
+   public:
+    using key_type = uint32_t;
+
+    struct Slot {
+        key_type id{};
+        T value{};
+        bool used{};
+    };
+
+   private:
+    std::vector<Slot> slots;
+    size_t count = 0;
+    int shift = 32;
+
+    // Fibonacci hashing spreads ids over the table using their high bits.
+    [[nodiscard]] size_t home(key_type id) const {
+        return (size_t)((uint32_t)(id * 2654435769u) >> shift);
+    }
+
+    [[nodiscard]] size_t mask() const { return slots.size() - 1; }
+
+    [[nodiscard]] size_t find_slot(key_type id) const {
+        size_t slot = home(id);
+        while (slots[slot].used && slots[slot].id != id) {
+            slot = (slot + 1) & mask();
+        }
+        return slot;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        shift = 32 - std::countr_zero(capacity);
+        for (auto &slot : old) {
+            if (slot.used) slots[find_slot(slot.id)] = std::move(slot);
+        }
+    }
+
+   public:
+    // Iterator over used slots, in order of slots.
+    template <typename TableSlot>
+    class basic_iterator {
+        TableSlot *slot;
+        TableSlot *last;
+
+       public:
+        basic_iterator(TableSlot *s, TableSlot *l) : slot(s), last(l) {
+            while (slot != last && !slot->used) slot++;
+        }
+
+        TableSlot &operator*() const { return *slot; }
+
+        TableSlot *operator->() const { return slot; }
+
+        basic_iterator &operator++() {
+            do {
+                slot++;
+            } while (slot != last && !slot->used);
+            return *this;
+        }
+
+        bool operator==(const basic_iterator &that) const { return slot == that.slot; }
+    };
+
+    using iterator = basic_iterator<Slot>;
+    using const_iterator = basic_iterator<const Slot>;
+
+    iterator begin() { return {slots.data(), slots.data() + slots.size()}; }
+
+    iterator end() { return {slots.data() + slots.size(), slots.data() + slots.size()}; }
+
+    [[nodiscard]] const_iterator begin() const {
+        return {slots.data(), slots.data() + slots.size()};
+    }
+
+    [[nodiscard]] const_iterator end() const {
+        return {slots.data() + slots.size(), slots.data() + slots.size()};
+    }
+
+    [[nodiscard]] size_t size() const { return count; }
+
+    [[nodiscard]] bool empty() const { return count == 0; }
+
+    // Returns value with the given id, inserting default one if there was none.
+    T &operator[](key_type id) {
+        // Table is kept at most half full, so probe sequences stay short.
+        if (2 * (count + 1) > slots.size()) {
+            rehash(slots.empty() ? MIN_CAPACITY : 2 * slots.size());
+        }
+        Slot &slot = slots[find_slot(id)];
+        if (!slot.used) {
+            slot.id = id;
+            slot.value = T{};
+            slot.used = true;
+            count++;
+        }
+        return slot.value;
+    }
+
+    // Removes value with the given id and returns it,
+    // or returns default value if there was none.
+    T take(key_type id) {
+        if (count == 0) return T{};
+        size_t hole = find_slot(id);
+        if (!slots[hole].used) return T{};
+        T value = std::move(slots[hole].value);
+        // Elements after the hole that could not be placed in it are moved back.
+        size_t next = (hole + 1) & mask();
+        while (slots[next].used) {
+            size_t wanted = home(slots[next].id);
+            if (((next - wanted) & mask()) >= ((next - hole) & mask())) {
+                slots[hole] = std::move(slots[next]);
+                hole = next;
+            }
+            next = (next + 1) & mask();
+        }
+        slots[hole].used = false;
+        count--;
+        return value;
+    }
+
+    void clear() {
+        if (count == 0) return;
+        for (auto &slot : slots) {
+            slot.used = false;
+        }
+        count = 0;
+    }
+};
+
+#endif  // BOMBERMAN_TABLES_HPP
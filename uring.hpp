@@ -0,0 +1,419 @@
+/* io_uring backend of the server for Linux. The Boost.Asio version we use
+ * does not support io_uring, so the ring is set up with plain system calls.
+ * It is driven by the asio io_context of a game thread, which keeps running
+ * timers and posted handlers as before. */
+
+#ifndef BOMBERMAN_URING_HPP
+#define BOMBERMAN_URING_HPP
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define BOMBERMAN_HAS_IO_URING 1
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#include "session.hpp"
+
+// Number of submission queue entries, completion queue is bigger.
+static const unsigned URING_ENTRIES = 4096;
+// Received data is put by the kernel into one of these buffers.
+static const unsigned URING_RECEIVE_BUFFERS = 256;
+static const unsigned URING_RECEIVE_BUFFER_SIZE = 4096;
+// Group id of the receive buffers, there is one group per ring.
+static const uint16_t URING_BUFFER_GROUP = 0;
+
+// Operation submitted to the ring. Handler is called with the result of
+// every completion, multishot operations complete many times. After the
+// last completion the handler is released, so it can keep its owner alive.
+struct UringOperation {
+    std::function<void(int result, uint32_t flags)> handler;
+};
+
+// Submission and completion queues of one io_uring instance.
+class Uring {
+    int ring_fd = -1;
+
+    void *sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void *cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned *sq_head{}, *sq_tail{}, *sq_array{};
+    unsigned sq_mask{}, sq_entries{};
+    unsigned *cq_head{}, *cq_tail{};
+    unsigned cq_mask{};
+    io_uring_cqe *cqes{};
+
+    // Entries filled but not yet passed to the kernel.
+    unsigned pending = 0;
+
+    static void *map(size_t size, int fd, off_t offset) {
+        void *p =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (p == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "mmap");
+        return p;
+    }
+
+    template <typename T>
+    T *at(void *ring, uint32_t offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+
+   public:
+    explicit Uring(unsigned entries) {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+        params.cq_entries = 4 * entries;
+        ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0) throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = map(sq_ring_size, ring_fd, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring = sq_ring;
+        } else {
+            cq_ring = map(cq_ring_size, ring_fd, IORING_OFF_CQ_RING);
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(map(sqes_size, ring_fd, IORING_OFF_SQES));
+
+        sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+        sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+        sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+        sq_mask = *at<unsigned>(sq_ring, params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+        cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+        cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    }
+
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    ~Uring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (ring_fd >= 0) ::close(ring_fd);
+    }
+
+    [[nodiscard]] int get_fd() const { return ring_fd; }
+
+    // Returns cleared entry to fill. If the queue is full,
+    // entries filled so far are submitted first.
+    io_uring_sqe *get_sqe() {
+        unsigned head = std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+        unsigned tail = *sq_tail + pending;
+        if (tail - head == sq_entries) {
+            submit();
+            tail = *sq_tail;
+        }
+        unsigned index = tail & sq_mask;
+        sq_array[index] = index;
+        pending++;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // Passes all filled entries to the kernel with one system call.
+    void submit() {
+        if (pending == 0) return;
+        std::atomic_ref<unsigned>(*sq_tail).store(*sq_tail + pending, std::memory_order_release);
+        unsigned to_submit = pending;
+        pending = 0;
+        while (to_submit > 0) {
+            int submitted = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, 0, 0, nullptr, 0);
+            if (submitted < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+            to_submit -= std::min(to_submit, (unsigned)submitted);
+        }
+    }
+
+    // Calls f for every completion posted so far.
+    template <typename F>
+    void for_each_completion(F f) {
+        unsigned head = *cq_head;
+        while (true) {
+            unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+            if (head == tail) break;
+            for (; head != tail; head++) {
+                const io_uring_cqe &cqe = cqes[head & cq_mask];
+                f(cqe.user_data, cqe.res, cqe.flags);
+            }
+            std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+        }
+    }
+
+    void register_resource(unsigned opcode, void *arg, unsigned count) {
+        if (syscall(__NR_io_uring_register, ring_fd, opcode, arg, count) < 0) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_register");
+        }
+    }
+};
+
+// Ring serving all sessions of one game thread, run by its io_context.
+// Completions are signaled with an eventfd watched by the io_context.
+// Operations started by a handler are submitted after it returns, together
+// with all others started in the meantime, so a turn sent to every session
+// of a game costs a single system call.
+class UringLoop {
+    boost::asio::io_context &io_context;
+    Uring ring{URING_ENTRIES};
+
+    boost::asio::posix::stream_descriptor notifications;
+    uint64_t notifications_count = 0;
+    bool submit_scheduled = false;
+
+    // Buffers registered with the ring, the kernel picks one for every receive.
+    io_uring_buf_ring *buffer_ring = static_cast<io_uring_buf_ring *>(MAP_FAILED);
+    size_t buffer_ring_size = URING_RECEIVE_BUFFERS * sizeof(io_uring_buf);
+    std::unique_ptr<char[]> buffers;
+    uint16_t buffers_tail = 0;
+
+    void wait_for_completions() {
+        notifications.async_read_some(
+            boost::asio::buffer(&notifications_count, sizeof(notifications_count)),
+            [this](const boost::system::error_code &error, size_t) {
+                if (error) return;
+                handle_completions();
+                wait_for_completions();
+            });
+    }
+
+    void handle_completions() {
+        ring.for_each_completion([](uint64_t user_data, int result, uint32_t flags) {
+            auto *operation = reinterpret_cast<UringOperation *>(user_data);
+            if (flags & IORING_CQE_F_MORE) {
+                operation->handler(result, flags);
+            } else {
+                // Last completion, handler may start the operation again.
+                auto handler = std::move(operation->handler);
+                operation->handler = nullptr;
+                handler(result, flags);
+            }
+        });
+    }
+
+    void schedule_submit() {
+        if (submit_scheduled) return;
+        submit_scheduled = true;
+        boost::asio::post(io_context, [this]() {
+            submit_scheduled = false;
+            ring.submit();
+        });
+    }
+
+    io_uring_sqe *prepare(uint8_t opcode, int fd, UringOperation &operation) {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->user_data = reinterpret_cast<uint64_t>(&operation);
+        schedule_submit();
+        return sqe;
+    }
+
+    void provide_buffer(uint16_t id) {
+        // Entries are addressed directly, the header declares them as a flexible
+        // array inside a union, which compilers do not expect to be indexed.
+        io_uring_buf &buffer = reinterpret_cast<io_uring_buf *>(
+            buffer_ring)[buffers_tail & (URING_RECEIVE_BUFFERS - 1)];
+        buffer.addr = reinterpret_cast<uint64_t>(buffers.get() + id * URING_RECEIVE_BUFFER_SIZE);
+        buffer.len = URING_RECEIVE_BUFFER_SIZE;
+        buffer.bid = id;
+        buffers_tail++;
+        std::atomic_ref<uint16_t>(buffer_ring->tail).store(buffers_tail, std::memory_order_release);
+    }
+
+   public:
+    explicit UringLoop(boost::asio::io_context &context)
+        : io_context(context), notifications(context) {
+        static_assert((URING_RECEIVE_BUFFERS & (URING_RECEIVE_BUFFERS - 1)) == 0);
+        int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd < 0) throw std::system_error(errno, std::generic_category(), "eventfd");
+        notifications.assign(event_fd);
+        ring.register_resource(IORING_REGISTER_EVENTFD, &event_fd, 1);
+
+        void *ring_memory = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (ring_memory == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        buffer_ring = static_cast<io_uring_buf_ring *>(ring_memory);
+        io_uring_buf_reg registration{};
+        registration.ring_addr = reinterpret_cast<uint64_t>(ring_memory);
+        registration.ring_entries = URING_RECEIVE_BUFFERS;
+        registration.bgid = URING_BUFFER_GROUP;
+        ring.register_resource(IORING_REGISTER_PBUF_RING, &registration, 1);
+
+        buffers = std::make_unique<char[]>(URING_RECEIVE_BUFFERS * URING_RECEIVE_BUFFER_SIZE);
+        for (uint16_t id = 0; id < URING_RECEIVE_BUFFERS; id++) {
+            provide_buffer(id);
+        }
+        wait_for_completions();
+    }
+
+    UringLoop(const UringLoop &) = delete;
+    UringLoop &operator=(const UringLoop &) = delete;
+
+    ~UringLoop() {
+        if (buffer_ring != MAP_FAILED) munmap(buffer_ring, buffer_ring_size);
+    }
+
+    [[nodiscard]] boost::asio::io_context &get_io_context() const { return io_context; }
+
+    // Accepts connections until an error, every connection is one completion.
+    void accept_multishot(int fd, UringOperation &operation) {
+        io_uring_sqe *sqe = prepare(IORING_OP_ACCEPT, fd, operation);
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+    }
+
+    // Receives data until the connection is closed, every read is one
+    // completion with data in a buffer chosen by the kernel.
+    void receive_multishot(int fd, UringOperation &operation) {
+        io_uring_sqe *sqe = prepare(IORING_OP_RECV, fd, operation);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+    }
+
+    void send_message(int fd, const msghdr *message, UringOperation &operation) {
+        io_uring_sqe *sqe = prepare(IORING_OP_SENDMSG, fd, operation);
+        sqe->addr = reinterpret_cast<uint64_t>(message);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+
+    // Returns data of a receive completion.
+    [[nodiscard]] std::span<const char> received_data(int result, uint32_t flags) const {
+        uint16_t id = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        return {buffers.get() + id * URING_RECEIVE_BUFFER_SIZE, (size_t)result};
+    }
+
+    // Gives buffer of a receive completion back to the kernel.
+    void recycle_buffer(uint32_t flags) {
+        if (flags & IORING_CQE_F_BUFFER) {
+            provide_buffer((uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+    }
+};
+
+// Session of the io_uring backend. It keeps one multishot receive running
+// for the whole connection, and writes all queued messages with one sendmsg.
+class UringSession : public Session {
+    UringLoop &loop;
+    int fd;
+
+    UringOperation receive_operation;
+    UringOperation send_operation;
+    // Remaining part of the write in progress.
+    std::vector<iovec> iovecs;
+    size_t iovecs_done = 0;
+    msghdr message{};
+
+    void read() override {
+        receive_operation.handler = [this, self = shared_from_this()](int result, uint32_t flags) {
+            if (result > 0) {
+                std::span<const char> data = loop.received_data(result, flags);
+                memcpy(input.prepare(data.size()), data.data(), data.size());
+                input.commit(data.size());
+            }
+            loop.recycle_buffer(flags);
+            if (closed) return;
+            if (result > 0 && !handle_received()) return;
+            if (flags & IORING_CQE_F_MORE) return;
+            // Kernel had no free buffer, so it stopped receiving for a while.
+            if (result == -ENOBUFS || result > 0) {
+                read();
+            } else {
+                close();
+            }
+        };
+        loop.receive_multishot(fd, receive_operation);
+    }
+
+    void send_rest() {
+        message.msg_iov = iovecs.data() + iovecs_done;
+        message.msg_iovlen = std::min(iovecs.size() - iovecs_done, (size_t)IOV_MAX);
+        send_operation.handler = [this, self = shared_from_this()](int result, uint32_t) {
+            if (result < 0) {
+                handle_written(false);
+                return;
+            }
+            // Skips the sent part, sendmsg on a socket may send less than asked.
+            auto sent = (size_t)result;
+            while (iovecs_done < iovecs.size() && sent >= iovecs[iovecs_done].iov_len) {
+                sent -= iovecs[iovecs_done++].iov_len;
+            }
+            if (iovecs_done == iovecs.size()) {
+                handle_written(true);
+                return;
+            }
+            iovecs[iovecs_done].iov_base = static_cast<char *>(iovecs[iovecs_done].iov_base) + sent;
+            iovecs[iovecs_done].iov_len -= sent;
+            send_rest();
+        };
+        loop.send_message(fd, &message, send_operation);
+    }
+
+    void write_gathered(std::span<const boost::asio::const_buffer> buffers) override {
+        iovecs.clear();
+        for (const auto &buffer : buffers) {
+            iovecs.push_back({const_cast<void *>(buffer.data()), buffer.size()});
+        }
+        iovecs_done = 0;
+        send_rest();
+    }
+
+    // Pending operations complete with an error, then the session is released.
+    void close_socket() override { ::shutdown(fd, SHUT_RDWR); }
+
+   public:
+    UringSession(UringLoop &uring_loop, int socket_fd)
+        : Session(uring_loop.get_io_context()), loop(uring_loop), fd(socket_fd) {
+        tcp::endpoint endpoint;
+        socklen_t length = (socklen_t)endpoint.capacity();
+        if (getpeername(fd, endpoint.data(), &length) < 0) {
+            ::close(fd);
+            throw std::system_error(errno, std::generic_category(), "getpeername");
+        }
+        endpoint.resize(length);
+        address = address_from_endpoint(endpoint);
+        int enabled = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    }
+
+    ~UringSession() override { ::close(fd); }
+};
+
+#endif  // defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+#endif  // BOMBERMAN_URING_HPP